@@ -108,12 +108,12 @@ void ram_getsize(paddr_t *lo, paddr_t *hi);
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+struct semaphore;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	struct addrspace *ts_addrspace;
-	vaddr_t ts_vaddr;
+	uint32_t ts_ehi;		/* page and ASID to invalidate */
+	bool ts_wholeasid;		/* every page of ts_ehi's ASID instead */
+	struct semaphore *ts_done;	/* V'd once the entry is gone */
 };
 
 #define TLBSHOOTDOWN_MAX 16
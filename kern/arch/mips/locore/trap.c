@@ -39,6 +39,11 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <syscall.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <kern/wait.h>
+#endif
 
 
 /* in exception.S */
@@ -108,6 +113,12 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 		break;
 	}
 
+#if OPT_A3
+	/* Take down just the process, as if it had been sent the signal */
+	kprintf("Fatal user mode trap %u sig %d (%s, epc 0x%x, vaddr 0x%x)\n",
+		code, sig, trapcodenames[code], epc, vaddr);
+	proc_exit(_MKWAIT_SIG(sig));
+#else
 	/*
 	 * You will probably want to change this.
 	 */
@@ -115,6 +126,7 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 	kprintf("Fatal user mode trap %u sig %d (%s, epc 0x%x, vaddr 0x%x)\n",
 		code, sig, trapcodenames[code], epc, vaddr);
 	panic("I don't know how to handle this\n");
+#endif /* OPT_A3 */
 }
 
 /*
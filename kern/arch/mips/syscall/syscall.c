@@ -36,8 +36,452 @@
 #include <current.h>
 #include <syscall.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
+
+#ifdef OPT_A2
+#include <endian.h>
+#include <copyinout.h>
+#include <spinlock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <clock.h>
+#endif /* OPT_A2 */
 
 
+#ifdef OPT_A2
+/*
+ * System call table.
+ *
+ * Each system call has a descriptor, indexed by call number, with its
+ * name and a handler that takes its arguments out of the trapframe and
+ * calls the sys_ function. Numbers with no handler are ENOSYS.
+ *
+ * Every call is timed with gettime(), and counted in the current
+ * cpu's syscall_stats: how many calls, their total time, and a
+ * histogram of their latencies by powers of 2 nanoseconds. The "ks"
+ * menu command adds up all the cpus and prints it.
+ */
+
+#define NSYSCALLS 128		/* past the highest SYS_ number */
+#define SYSCALL_NHIST 32	/* bucket i is latencies in [2^i, 2^(i+1)) ns */
+
+struct syscall_desc {
+	const char *sd_name;
+	int (*sd_func)(struct trapframe *tf, int32_t *retval);
+};
+
+struct syscall_stats {
+	struct syscall_stats *ss_next;	/* all the cpus', for syscall_printstats */
+	struct {
+		uint32_t sc_calls;
+		uint64_t sc_nsecs;
+		uint32_t sc_hist[SYSCALL_NHIST];
+	} ss_calls[NSYSCALLS];
+};
+
+static struct spinlock syscall_stats_lock = SPINLOCK_INITIALIZER;
+static struct syscall_stats *syscall_stats_list;
+
+static
+int
+sc_reboot(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_reboot(tf->tf_a0);
+}
+
+static
+int
+sc___time(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys___time((userptr_t)tf->tf_a0,
+			  (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc___clock_gettime(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys___clock_gettime((int)tf->tf_a0,
+				   (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_nanosleep(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_nanosleep((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_write(struct trapframe *tf, int32_t *retval)
+{
+	return sys_write((int)tf->tf_a0,
+			 (userptr_t)tf->tf_a1,
+			 (int)tf->tf_a2,
+			 (int *)retval);
+}
+
+static
+int
+sc__exit(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	sys__exit((int)tf->tf_a0);
+	/* sys__exit does not return, execution should not get here */
+	panic("unexpected return from sys__exit");
+	return 0;
+}
+
+static
+int
+sc_getpid(struct trapframe *tf, int32_t *retval)
+{
+	(void)tf;
+	return sys_getpid((pid_t *)retval);
+}
+
+static
+int
+sc_waitpid(struct trapframe *tf, int32_t *retval)
+{
+	return sys_waitpid((pid_t)tf->tf_a0,
+			   (userptr_t)tf->tf_a1,
+			   (int)tf->tf_a2,
+			   (pid_t *)retval);
+}
+
+static
+int
+sc_fork(struct trapframe *tf, int32_t *retval)
+{
+	//Just throw the entire trapframe. Since it needs to be copied to the child
+	return sys_fork(tf, (pid_t *)retval);
+}
+
+static
+int
+sc_vfork(struct trapframe *tf, int32_t *retval)
+{
+	return sys_vfork(tf, (pid_t *)retval);
+}
+
+static
+int
+sc_execv(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+}
+
+static
+int
+sc_spawn(struct trapframe *tf, int32_t *retval)
+{
+	return sys_spawn((userptr_t)tf->tf_a0,
+			 (userptr_t)tf->tf_a1,
+			 (pid_t *)retval);
+}
+
+static
+int
+sc_open(struct trapframe *tf, int32_t *retval)
+{
+	return sys_open((userptr_t)tf->tf_a0,
+			(int)tf->tf_a1,
+			(mode_t)tf->tf_a2,
+			(int *)retval);
+}
+
+static
+int
+sc_read(struct trapframe *tf, int32_t *retval)
+{
+	return sys_read((int)tf->tf_a0,
+			(userptr_t)tf->tf_a1,
+			(int)tf->tf_a2,
+			(int *)retval);
+}
+
+static
+int
+sc_lseek(struct trapframe *tf, int32_t *retval)
+{
+	uint64_t pos;
+	off_t retval64;
+	int whence;
+	int err;
+
+	/* the offset is in a2/a3, so whence is on the user stack */
+	join32to64(tf->tf_a2, tf->tf_a3, &pos);
+	err = copyin((const_userptr_t)(tf->tf_sp + 16), &whence, sizeof(int));
+	if (err) {
+		return err;
+	}
+	err = sys_lseek((int)tf->tf_a0, pos, whence, &retval64);
+	if (!err) {
+		/* the 64-bit result goes back in v0/v1 */
+		split64to32(retval64, &tf->tf_v0, &tf->tf_v1);
+		*retval = tf->tf_v0;
+	}
+	return err;
+}
+
+static
+int
+sc_close(struct trapframe *tf, int32_t *retval)
+{
+	(void)retval;
+	return sys_close((int)tf->tf_a0);
+}
+
+static
+int
+sc_dup2(struct trapframe *tf, int32_t *retval)
+{
+	return sys_dup2((int)tf->tf_a0,
+			(int)tf->tf_a1,
+			(int *)retval);
+}
+
+static
+int
+sc_pipe(struct trapframe *tf, int32_t *retval)
+{
+	return sys_pipe((userptr_t)tf->tf_a0, (int *)retval);
+}
+
+/* pread and pwrite: the offset skips a3 to be 8-aligned, so it is on the stack */
+static
+int
+sc_prw(struct trapframe *tf, int32_t *retval, bool write)
+{
+	uint32_t hilo[2];
+	uint64_t pos;
+	int err;
+
+	err = copyin((const_userptr_t)(tf->tf_sp + 16), hilo, sizeof(hilo));
+	if (err) {
+		return err;
+	}
+	join32to64(hilo[0], hilo[1], &pos);
+	if (write) {
+		return sys_pwrite((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+				  (size_t)tf->tf_a2, pos, (int *)retval);
+	}
+	return sys_pread((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			 (size_t)tf->tf_a2, pos, (int *)retval);
+}
+
+static
+int
+sc_pread(struct trapframe *tf, int32_t *retval)
+{
+	return sc_prw(tf, retval, false);
+}
+
+static
+int
+sc_pwrite(struct trapframe *tf, int32_t *retval)
+{
+	return sc_prw(tf, retval, true);
+}
+
+static
+int
+sc_readv(struct trapframe *tf, int32_t *retval)
+{
+	return sys_readv((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			 (int)tf->tf_a2, (int *)retval);
+}
+
+static
+int
+sc_writev(struct trapframe *tf, int32_t *retval)
+{
+	return sys_writev((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			  (int)tf->tf_a2, (int *)retval);
+}
+
+static
+int
+sc_ioring_enter(struct trapframe *tf, int32_t *retval)
+{
+	return sys_ioring_enter((userptr_t)tf->tf_a0, (int *)retval);
+}
+
+#if OPT_A3
+static
+int
+sc_sbrk(struct trapframe *tf, int32_t *retval)
+{
+	return sys_sbrk((intptr_t)tf->tf_a0, (vaddr_t *)retval);
+}
+#endif /* OPT_A3 */
+
+static const struct syscall_desc syscalls[NSYSCALLS] = {
+	[SYS_fork] =		{ "fork",	sc_fork },
+	[SYS_vfork] =		{ "vfork",	sc_vfork },
+	[SYS_execv] =		{ "execv",	sc_execv },
+	[SYS__exit] =		{ "_exit",	sc__exit },
+	[SYS_waitpid] =		{ "waitpid",	sc_waitpid },
+	[SYS_getpid] =		{ "getpid",	sc_getpid },
+#if OPT_A3
+	[SYS_sbrk] =		{ "sbrk",	sc_sbrk },
+#endif /* OPT_A3 */
+	[SYS_open] =		{ "open",	sc_open },
+	[SYS_pipe] =		{ "pipe",	sc_pipe },
+	[SYS_dup2] =		{ "dup2",	sc_dup2 },
+	[SYS_close] =		{ "close",	sc_close },
+	[SYS_read] =		{ "read",	sc_read },
+	[SYS_write] =		{ "write",	sc_write },
+	[SYS_pread] =		{ "pread",	sc_pread },
+	[SYS_pwrite] =		{ "pwrite",	sc_pwrite },
+	[SYS_readv] =		{ "readv",	sc_readv },
+	[SYS_writev] =		{ "writev",	sc_writev },
+	[SYS_lseek] =		{ "lseek",	sc_lseek },
+	[SYS_ioring_enter] =	{ "ioring_enter", sc_ioring_enter },
+	[SYS___time] =		{ "__time",	sc___time },
+	[SYS_reboot] =		{ "reboot",	sc_reboot },
+	[SYS_spawn] =		{ "spawn",	sc_spawn },
+	[SYS___clock_gettime] =	{ "__clock_gettime", sc___clock_gettime },
+	[SYS_nanosleep] =	{ "nanosleep",	sc_nanosleep },
+};
+
+struct syscall_stats *
+syscall_stats_create(void)
+{
+	struct syscall_stats *ss;
+
+	ss = kmalloc(sizeof(*ss));
+	if (ss == NULL) {
+		return NULL;
+	}
+	bzero(ss, sizeof(*ss));
+
+	spinlock_acquire(&syscall_stats_lock);
+	ss->ss_next = syscall_stats_list;
+	syscall_stats_list = ss;
+	spinlock_release(&syscall_stats_lock);
+
+	return ss;
+}
+
+/*
+ * Count a call to CALLNO that took from BEFORE to AFTER. The thread
+ * can have moved to another cpu in between; the call is counted on
+ * the one it finished on.
+ */
+static
+void
+syscall_account(int callno, time_t beforesecs, uint32_t beforensecs,
+		time_t aftersecs, uint32_t afternsecs)
+{
+	struct syscall_stats *ss;
+	time_t secs;
+	uint32_t nsecs;
+	uint64_t total;
+	unsigned bucket;
+	int spl;
+
+	getinterval(beforesecs, beforensecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+	total = (uint64_t)secs * 1000000000 + nsecs;
+
+	/* floor(log2(total)), and everything past the end in the last bucket */
+	for (bucket = 0; bucket < SYSCALL_NHIST - 1 && (total >> (bucket + 1)) != 0; bucket++) {
+		/* nothing */
+	}
+
+	/* Stay on this cpu while updating its counters */
+	spl = splhigh();
+	ss = curcpu->c_syscallstats;
+	ss->ss_calls[callno].sc_calls++;
+	ss->ss_calls[callno].sc_nsecs += total;
+	ss->ss_calls[callno].sc_hist[bucket]++;
+	splx(spl);
+}
+
+void
+syscall_printstats(void)
+{
+	struct syscall_stats *sum, *ss;
+	uint64_t mostnsecs;
+	unsigned i, j, best;
+	bool *printed;
+
+	/* Too big for the stack */
+	sum = kmalloc(sizeof(*sum));
+	printed = kmalloc(NSYSCALLS * sizeof(bool));
+	if (sum == NULL || printed == NULL) {
+		kfree(sum);
+		kfree(printed);
+		kprintf("syscall stats: Out of memory\n");
+		return;
+	}
+	bzero(sum, sizeof(*sum));
+
+	/* Other cpus keep counting while we read; near enough for stats */
+	spinlock_acquire(&syscall_stats_lock);
+	for (ss = syscall_stats_list; ss != NULL; ss = ss->ss_next) {
+		for (i = 0; i < NSYSCALLS; i++) {
+			sum->ss_calls[i].sc_calls += ss->ss_calls[i].sc_calls;
+			sum->ss_calls[i].sc_nsecs += ss->ss_calls[i].sc_nsecs;
+			for (j = 0; j < SYSCALL_NHIST; j++) {
+				sum->ss_calls[i].sc_hist[j] += ss->ss_calls[i].sc_hist[j];
+			}
+		}
+	}
+	spinlock_release(&syscall_stats_lock);
+
+	kprintf("%-10s %10s %14s %10s\n", "syscall", "calls", "total us", "mean us");
+
+	/* Biggest total time first */
+	for (i = 0; i < NSYSCALLS; i++) {
+		printed[i] = sum->ss_calls[i].sc_calls == 0;
+	}
+	while (1) {
+		best = NSYSCALLS;
+		mostnsecs = 0;
+		for (i = 0; i < NSYSCALLS; i++) {
+			if (!printed[i] &&
+			    (best == NSYSCALLS || sum->ss_calls[i].sc_nsecs > mostnsecs)) {
+				best = i;
+				mostnsecs = sum->ss_calls[i].sc_nsecs;
+			}
+		}
+		if (best == NSYSCALLS) {
+			break;
+		}
+		printed[best] = true;
+
+		kprintf("%-10s %10u %14llu %10llu\n",
+			syscalls[best].sd_name != NULL ?
+			syscalls[best].sd_name : "?",
+			sum->ss_calls[best].sc_calls,
+			sum->ss_calls[best].sc_nsecs / 1000,
+			sum->ss_calls[best].sc_nsecs / 1000 /
+			sum->ss_calls[best].sc_calls);
+
+		/* The histogram, leaving out empty buckets */
+		kprintf("          ");
+		for (j = 0; j < SYSCALL_NHIST; j++) {
+			if (sum->ss_calls[best].sc_hist[j] != 0) {
+				kprintf(" 2^%u:%u", j, sum->ss_calls[best].sc_hist[j]);
+			}
+		}
+		kprintf(" (ns)\n");
+	}
+
+	kfree(printed);
+	kfree(sum);
+}
+#endif /* OPT_A2 */
+
 /*
  * System call dispatcher.
  *
@@ -82,6 +526,10 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+#ifdef OPT_A2
+	time_t beforesecs, aftersecs;
+	uint32_t beforensecs, afternsecs;
+#endif /* OPT_A2 */
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -100,6 +548,19 @@ syscall(struct trapframe *tf)
 
 	retval = 0;
 
+#ifdef OPT_A2
+	if (callno >= 0 && callno < NSYSCALLS && syscalls[callno].sd_func != NULL) {
+		gettime(&beforesecs, &beforensecs);
+		err = syscalls[callno].sd_func(tf, &retval);
+		gettime(&aftersecs, &afternsecs);
+		syscall_account(callno, beforesecs, beforensecs,
+				aftersecs, afternsecs);
+	}
+	else {
+		kprintf("Unknown syscall %d\n", callno);
+		err = ENOSYS;
+	}
+#else
 	switch (callno) {
 	    case SYS_reboot:
 		err = sys_reboot(tf->tf_a0);
@@ -132,23 +593,17 @@ syscall(struct trapframe *tf)
 	  break;
 #endif // UW
 
-	    /* Add stuff here */
- 
-#ifdef OPT_A2
-	case SYS_fork:
-	  err = sys_fork(tf, (pid_t *) &retval); //Just throw the entire trapframe. Since it needs to be copied to the child
-	  break;
-	case SYS_execv:
-	  err = sys_execv((userptr_t) tf->tf_a0, (userptr_t) tf->tf_a1);
+#if OPT_A3
+	case SYS_sbrk:
+	  err = sys_sbrk((intptr_t)tf->tf_a0, (vaddr_t *)&retval);
 	  break;
-
-#endif /* OPT_A2 */
+#endif /* OPT_A3 */
 	default:
 	  kprintf("Unknown syscall %d\n", callno);
 	  err = ENOSYS;
 	  break;
 	}
-
+#endif /* OPT_A2 */
 
 	if (err) {
 		/*
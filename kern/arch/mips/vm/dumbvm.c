@@ -39,71 +39,870 @@
 #include <vm.h>
 #include <copyinout.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
+
+#ifdef OPT_A2
+#include <clock.h>
+#include <kern/timepage.h>
+#endif /* OPT_A2 */
+
+#if OPT_A3
+#include <cpu.h>
+#include <synch.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <uio.h>
+#include <vnode.h>
+#include <uw-vmstats.h>
+#endif /* OPT_A3 */
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
  * enough to struggle off the ground.
  */
 
-/* under dumbvm, always have 48k of user stack */
-#define DUMBVM_STACKPAGES    12
+#if OPT_A3
+/*
+ * The stack starts out as one page and grows down, a page at a time,
+ * as the process faults below it, up to this many bytes.
+ */
+#define DUMBVM_STACKLIMIT    (1024 * 1024)
+
+#ifdef OPT_A2
+/* The time page sits between the heap and the stack, and the heap stops below it */
+#if TIMEPAGE_VADDR != USERSTACK - DUMBVM_STACKLIMIT - PAGE_SIZE
+#error "TIMEPAGE_VADDR should be the page below the stack limit"
+#endif
+#define DUMBVM_HEAPLIMIT     TIMEPAGE_VADDR
+#else
+#define DUMBVM_HEAPLIMIT     (USERSTACK - DUMBVM_STACKLIMIT)
+#endif /* OPT_A2 */
+#else
+/* under dumbvm, always have 48k of user stack */
+#define DUMBVM_STACKPAGES    12
+#endif /* OPT_A3 */
+
+/*
+ * Wrap rma_stealmem in a spinlock.
+ */
+static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+
+#if OPT_A3
+/*
+ * TLB replacement policy once every entry is valid: round-robin over
+ * the slots by default, or set this to 1 to let the hardware pick with
+ * tlb_random. The VMSTAT_TLB_FAULT_REPLACE count compares the two.
+ */
+#define DUMBVM_TLB_RANDOM 0
+
+#if !DUMBVM_TLB_RANDOM
+/* Next slot to evict. Only looked at with interrupts off. */
+static uint32_t tlb_victim = 0;
+#endif
+
+/*
+ * Address space IDs.
+ *
+ * TLB entries are tagged with the ASID of the address space they
+ * belong to, so switching processes doesn't require a TLB flush. IDs
+ * are handed out in order until they run out; then the generation is
+ * bumped and numbering starts over. An address space whose ASID is
+ * from an old generation gets a new one the next time it is activated,
+ * and a cpu whose TLB holds entries from an old generation flushes it
+ * the first time it activates anything from the new one.
+ *
+ * ASID 0 is never handed out; the TLB invalidation entries are
+ * written with it.
+ */
+#define ASID_FIRST 1
+
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+static uint32_t asid_generation = 1;	/* 0 means "no ASID yet" */
+static uint32_t asid_next = ASID_FIRST;
+
+/*
+ * Paging.
+ *
+ * vm_lock is held by anything that changes a page table: vm_fault,
+ * fork, exit, and evicting a page. Evicting changes the page table of
+ * some other process, so this keeps things simple: one page moves at a
+ * time, and nobody else's fault can see a page half way to disk.
+ *
+ * Eviction can be needed by whoever holds vm_lock (a fault that needs
+ * a frame, or a page table allocation inside one) and by any kmalloc
+ * that is allowed to sleep; vm_reclaim only takes the lock if the
+ * caller doesn't already have it.
+ *
+ * Evictions are serialized, so there is never more than one shootdown
+ * outstanding per cpu and vm_shootdown_sem is never shared.
+ */
+static struct lock *vm_lock;
+static struct semaphore *vm_shootdown_sem;
+
+void
+vm_bootstrap(void)
+{
+	/* From here on physical memory comes from (and goes back to) the coremap */
+	coremap_bootstrap();
+	vmstats_init();
+
+	vm_lock = lock_create("vm");
+	vm_shootdown_sem = sem_create("vm shootdown", 0);
+	if (vm_lock == NULL || vm_shootdown_sem == NULL) {
+		panic("vm_bootstrap: out of memory\n");
+	}
+
+	/* The disks were attached by mainbus_bootstrap */
+	swap_bootstrap();
+}
+#else
+void
+vm_bootstrap(void)
+{
+	/* Do nothing. */
+}
+#endif /* OPT_A3 */
+
+static
+paddr_t
+getppages(unsigned long npages)
+{
+	paddr_t addr;
+
+	spinlock_acquire(&stealmem_lock);
+
+	addr = ram_stealmem(npages);
+	
+	spinlock_release(&stealmem_lock);
+	return addr;
+}
+
+#if OPT_A3
+
+/* Zero-fill a physical page range (used for pages handed to user space) */
+static
+void
+as_zero_region(paddr_t paddr, unsigned npages)
+{
+	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
+}
+
+/* The segment of AS that VADDR is in, or NULL. */
+static
+struct as_region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned i;
+	vaddr_t vbase, vtop;
+
+	for (i = 0; i < as->as_nregions; i++) {
+		vbase = as->as_regions[i].ar_vbase;
+		vtop = vbase + as->as_regions[i].ar_npages * PAGE_SIZE;
+		if (vaddr >= vbase && vaddr < vtop) {
+			return &as->as_regions[i];
+		}
+	}
+	return NULL;
+}
+
+/* Is VADDR inside one of the segments or the stack of AS? */
+static
+bool
+as_valid_address(struct addrspace *as, vaddr_t vaddr)
+{
+	if (as_find_region(as, vaddr) != NULL) {
+		return true;
+	}
+
+	if (vaddr >= as->as_heapbase && vaddr < ROUNDUP(as->as_heaptop, PAGE_SIZE)) {
+		return true;
+	}
+
+	return vaddr >= as->as_stackbase && vaddr < USERSTACK;
+}
+
+/*
+ * A fault below the bottom of the stack. If it's within the stack
+ * limit and doesn't run into the segments, extend the stack down to
+ * cover VADDR and return true.
+ */
+static
+bool
+as_grow_stack(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned i;
+	vaddr_t vtop;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	if (vaddr >= as->as_stackbase || vaddr < USERSTACK - DUMBVM_STACKLIMIT) {
+		return false;
+	}
+
+	for (i = 0; i < as->as_nregions; i++) {
+		vtop = as->as_regions[i].ar_vbase +
+			as->as_regions[i].ar_npages * PAGE_SIZE;
+		if (vaddr < vtop) {
+			return false;
+		}
+	}
+
+	DEBUG(DB_VM, "dumbvm: stack grows 0x%x -> 0x%x\n", as->as_stackbase, vaddr);
+	as->as_stackbase = vaddr;
+	return true;
+}
+
+/*
+ * May AS write to VADDR? Everything but the read-only segments of the
+ * executable can be written.
+ */
+static
+bool
+as_writeable(struct addrspace *as, vaddr_t vaddr)
+{
+	struct as_region *ar;
+
+	ar = as_find_region(as, vaddr);
+	return ar == NULL || ar->ar_writeable;
+}
+
+/*
+ * Remove the translation EHI (page and ASID) from this cpu's TLB.
+ * tlb_probe loads EntryHi, so put back the ASID of whatever is running.
+ */
+static
+void
+vm_tlb_invalidate(uint32_t ehi)
+{
+	int i, spl;
+
+	spl = splhigh();
+
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	tlb_setasid(curcpu->c_asid);
+
+	splx(spl);
+}
+
+/*
+ * Remove every translation tagged with ASID from this cpu's TLB.
+ * tlb_read loads EntryHi too, so again put back the running ASID.
+ */
+static
+void
+vm_tlb_invalidate_asid(uint32_t asid)
+{
+	uint32_t ehi, elo;
+	int i, spl;
+
+	spl = splhigh();
+
+	for (i = 0; i < NUM_TLB; i++) {
+		tlb_read(&ehi, &elo, i);
+		if ((elo & TLBLO_VALID) &&
+		    (ehi & TLBHI_PID) >> TLBHI_PIDSHIFT == asid) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+	tlb_setasid(curcpu->c_asid);
+
+	splx(spl);
+}
+
+/* Carry out TS on this cpu. */
+static
+void
+vm_tlb_flush(const struct tlbshootdown *ts)
+{
+	if (ts->ts_wholeasid) {
+		vm_tlb_invalidate_asid((ts->ts_ehi & TLBHI_PID) >> TLBHI_PIDSHIFT);
+	}
+	else {
+		vm_tlb_invalidate(ts->ts_ehi);
+	}
+}
+
+/* Carry out TS on every cpu and wait until it's done. */
+static
+void
+vm_tlb_broadcast(struct tlbshootdown *ts)
+{
+	unsigned n;
+	int spl;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	ts->ts_done = vm_shootdown_sem;
+
+	/* Stay on this cpu until the others have been told */
+	spl = splhigh();
+	vm_tlb_flush(ts);
+	n = ipi_tlbshootdown_broadcast(ts);
+	splx(spl);
+
+	while (n-- > 0) {
+		P(vm_shootdown_sem);
+	}
+}
+
+/* Remove VADDR of AS from every TLB and wait until it is gone. */
+static
+void
+vm_tlb_shootdown(struct addrspace *as, vaddr_t vaddr)
+{
+	struct tlbshootdown ts;
+
+	ts.ts_ehi = vaddr | (as->as_asid << TLBHI_PIDSHIFT);
+	ts.ts_wholeasid = false;
+	vm_tlb_broadcast(&ts);
+}
+
+/*
+ * Remove every page of AS from every TLB, for when too many pages
+ * change at once to shoot down one by one. AS keeps its ASID.
+ */
+static
+void
+vm_tlb_shootdown_as(struct addrspace *as)
+{
+	struct tlbshootdown ts;
+
+	ts.ts_ehi = as->as_asid << TLBHI_PIDSHIFT;
+	ts.ts_wholeasid = true;
+	vm_tlb_broadcast(&ts);
+	vmstats_inc(VMSTAT_TLB_INVALIDATE);
+}
+
+/*
+ * Page out one user frame and give it back to the coremap. Returns
+ * ENOMEM if there is no swap or nothing that can be evicted.
+ */
+static
+int
+vm_evict(void)
+{
+	struct addrspace *as;
+	vaddr_t vaddr;
+	paddr_t paddr;
+	pte_t *pte;
+	unsigned slot;
+	int result;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	if (!swap_available()) {
+		return ENOMEM;
+	}
+
+	paddr = coremap_victim(&as, &vaddr);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	KASSERT(pte != NULL);
+	KASSERT((*pte & PTE_VALID) && (*pte & PTE_FRAME) == paddr);
+
+	/* Nobody can write to it once it's out of the TLBs */
+	vm_tlb_shootdown(as, vaddr);
+
+	if (!as_writeable(as, vaddr)) {
+		/* Can't have changed, so just read it from the executable again */
+		DEBUG(DB_VM, "dumbvm: drop 0x%x (asid %u): 0x%x\n",
+		      vaddr, as->as_asid, paddr);
+		*pte = 0;
+		coremap_decref(paddr);
+		return 0;
+	}
+
+	result = swap_out(paddr, &slot);
+	if (result) {
+		return result;
+	}
+
+	DEBUG(DB_VM, "dumbvm: evict 0x%x (asid %u): 0x%x -> slot %u\n",
+	      vaddr, as->as_asid, paddr, slot);
+
+	*pte = PTE_MKSWAPPED(slot);
+	coremap_decref(paddr);
+
+	return 0;
+}
+
+/* Can the current thread sleep to page something out? */
+static
+bool
+vm_can_evict(void)
+{
+	return vm_lock != NULL && curthread != NULL &&
+		!curthread->t_in_interrupt && curthread->t_iplhigh_count == 0;
+}
+
+/* Evict a page, taking vm_lock unless the caller already holds it. */
+static
+int
+vm_reclaim(void)
+{
+	bool held;
+	int result;
+
+	held = lock_do_i_hold(vm_lock);
+	if (!held) {
+		lock_acquire(vm_lock);
+	}
+	result = vm_evict();
+	if (!held) {
+		lock_release(vm_lock);
+	}
+	return result;
+}
+
+/* Get a frame for a user page, paging something out if need be. */
+static
+paddr_t
+vm_alloc_upage(void)
+{
+	paddr_t paddr;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	while ((paddr = coremap_alloc_upage()) == 0) {
+		if (vm_evict()) {
+			return 0;
+		}
+	}
+	return paddr;
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t 
+alloc_kpages(int npages)
+{
+	paddr_t pa;
+
+	/* kmalloc is used before vm_bootstrap, so fall back to stealing memory until then */
+	if (coremap_isready()) {
+		pa = coremap_alloc_kpages(npages);
+		/* Paging out one frame won't make room for a longer block */
+		while (pa == 0 && npages == 1 && vm_can_evict()) {
+			if (vm_reclaim()) {
+				break;
+			}
+			pa = coremap_alloc_kpages(npages);
+		}
+	} else {
+		pa = getppages(npages);
+	}
+
+	if (pa==0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void 
+free_kpages(vaddr_t addr)
+{
+	KASSERT(addr >= MIPS_KSEG0);
+	coremap_free(addr - MIPS_KSEG0);
+}
+
+#else
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t 
+alloc_kpages(int npages)
+{
+	paddr_t pa;
+	pa = getppages(npages);
+	if (pa==0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void 
+free_kpages(vaddr_t addr)
+{
+	/* nothing - leak the memory. */
+
+	(void)addr;
+}
+
+#endif /* OPT_A3 */
+
+#if OPT_A3
+
+void
+vm_tlbshootdown_all(void)
+{
+	/*
+	 * Only happens if TLBSHOOTDOWN_MAX requests pile up, which
+	 * vm_lock prevents; the waiters would never be woken.
+	 */
+	panic("dumbvm: shootdown queue overflowed\n");
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	vm_tlb_flush(ts);
+	V(ts->ts_done);
+}
+
+#else
+
+void
+vm_tlbshootdown_all(void)
+{
+	panic("dumbvm tried to do tlb shootdown?!\n");
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	(void)ts;
+	panic("dumbvm tried to do tlb shootdown?!\n");
+}
+
+#endif /* OPT_A3 */
+
+#if OPT_A3
+
+/*
+ * Fill the new frame PADDR for page VADDR of AS: whatever part of the
+ * page the executable supplies is read in from as_vnode, and the rest
+ * is zeroed.
+ *
+ * The file is read without vm_lock. The filesystem can be holding its
+ * own locks while it copies out to a user page (and so waits for
+ * vm_lock), and the frame can't go anywhere meanwhile because it
+ * isn't mapped or owned yet.
+ */
+static
+int
+vm_fill_page(struct addrspace *as, vaddr_t vaddr, paddr_t paddr)
+{
+	struct as_region *ar;
+	vaddr_t start, end;
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	as_zero_region(paddr, 1);
+
+	/* The part of this page that comes from the file, if any */
+	ar = as_find_region(as, vaddr);
+	if (ar != NULL && ar->ar_filesize > 0) {
+		start = vaddr > ar->ar_filevaddr ? vaddr : ar->ar_filevaddr;
+		end = ar->ar_filevaddr + ar->ar_filesize;
+		if (end > vaddr + PAGE_SIZE) {
+			end = vaddr + PAGE_SIZE;
+		}
+	} else {
+		start = end = 0;
+	}
+
+	if (start >= end) {
+		/* BSS, stack, or a page the executable doesn't reach */
+		vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+		return 0;
+	}
+
+	KASSERT(as->as_vnode != NULL);
+
+	DEBUG(DB_EXEC, "ELF: demand loading %lu bytes to 0x%lx\n",
+	      (unsigned long) (end - start), (unsigned long) start);
+
+	uio_kinit(&iov, &ku, (void *)(PADDR_TO_KVADDR(paddr) + (start - vaddr)),
+		  end - start, ar->ar_fileoff + (start - ar->ar_filevaddr),
+		  UIO_READ);
+
+	lock_release(vm_lock);
+	result = VOP_READ(as->as_vnode, &ku);
+	lock_acquire(vm_lock);
+
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on segment - file truncated?\n");
+		return ENOEXEC;
+	}
+
+	vmstats_inc(VMSTAT_ELF_FILE_READ);
+	vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+	return 0;
+}
+
+/*
+ * Give AS write access to the page at VADDR. If the frame behind it is
+ * still shared copy-on-write with another address space, copy it first.
+ */
+static
+int
+vm_make_writable(struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+	paddr_t oldpaddr, newpaddr;
+
+	KASSERT(*pte & PTE_VALID);
+
+	oldpaddr = *pte & PTE_FRAME;
+
+	if (coremap_refcount(oldpaddr) > 1) {
+		/* Shared frames are never paged out, so oldpaddr stays put */
+		newpaddr = vm_alloc_upage();
+		if (newpaddr == 0) {
+			return ENOMEM;
+		}
+
+		memmove((void *)PADDR_TO_KVADDR(newpaddr),
+			(const void *)PADDR_TO_KVADDR(oldpaddr),
+			PAGE_SIZE);
+
+		DEBUG(DB_VM, "dumbvm: copy-on-write 0x%x: 0x%x -> 0x%x\n",
+		      vaddr, oldpaddr, newpaddr);
+
+		*pte = newpaddr | PTE_VALID;
+		coremap_setowner(newpaddr, as, vaddr);
+
+		/*
+		 * Any cpu AS has run on may still map vaddr to the old
+		 * frame read-only, and ASIDs survive moving between cpus,
+		 * so get rid of those before the frame can go to someone
+		 * else.
+		 */
+		vm_tlb_shootdown(as, vaddr);
+		coremap_decref(oldpaddr);
+	} else {
+		/* Everyone else let go of it already, so it's ours again */
+		coremap_setowner(oldpaddr, as, vaddr);
+	}
+
+	*pte |= PTE_WRITE;
+	return 0;
+}
+
+/*
+ * Load the translation EHI -> ELO into the TLB. An existing entry for
+ * the page is updated in place; otherwise a free slot is used if there
+ * is one, and a victim is evicted if not.
+ */
+static
+void
+vm_tlb_load(uint32_t ehi, uint32_t elo)
+{
+	uint32_t oldehi, oldelo;
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	/* After a copy-on-write fault the old read-only entry is still there */
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(ehi, elo, i);
+		splx(spl);
+		return;
+	}
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_read(&oldehi, &oldelo, i);
+		if (oldelo & TLBLO_VALID) {
+			continue;
+		}
+		vmstats_inc(VMSTAT_TLB_FAULT_FREE);
+		tlb_write(ehi, elo, i);
+		splx(spl);
+		return;
+	}
+
+	/* TLB is full - throw something out */
+	vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
+#if DUMBVM_TLB_RANDOM
+	tlb_random(ehi, elo);
+#else
+	tlb_write(ehi, elo, tlb_victim);
+	tlb_victim = (tlb_victim + 1) % NUM_TLB;
+#endif
+
+	splx(spl);
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	paddr_t paddr;
+	uint32_t elo;
+	struct addrspace *as;
+	pte_t *pte;
+	bool writeable;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+		/* Write to a read-only page, or one shared copy-on-write */
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+#ifdef OPT_A2
+	if (faultaddress == TIMEPAGE_VADDR) {
+		/* The same read-only frame in every process; no PTE, no vm_lock */
+		if (faulttype != VM_FAULT_READ) {
+			return EFAULT;
+		}
+		vmstats_inc(VMSTAT_TLB_FAULT);
+		vmstats_inc(VMSTAT_TLB_RELOAD);
+		vm_tlb_load(faultaddress | (as->as_asid << TLBHI_PIDSHIFT),
+			    timepage_paddr() | TLBLO_VALID);
+		return 0;
+	}
+#endif /* OPT_A2 */
+
+	KASSERT(as->as_pt != NULL);
+
+	if (!as_valid_address(as, faultaddress) &&
+	    !as_grow_stack(as, faultaddress)) {
+		return EFAULT;
+	}
+
+	/* Writing to text or read-only data kills the process */
+	writeable = as_writeable(as, faultaddress);
+	if (faulttype != VM_FAULT_READ && !writeable) {
+		return EFAULT;
+	}
+
+	/* Held until the TLB is loaded, so the page can't be evicted under us */
+	lock_acquire(vm_lock);
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		lock_release(vm_lock);
+		return ENOMEM;
+	}
+
+	/* A readonly fault isn't a TLB miss: the entry is there, just not writable */
+	if (faulttype != VM_FAULT_READONLY) {
+		vmstats_inc(VMSTAT_TLB_FAULT);
+	}
 
-/*
- * Wrap rma_stealmem in a spinlock.
- */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+	if (*pte & PTE_SWAPPED) {
+		/* Paged out: bring it back from swap */
+		paddr = vm_alloc_upage();
+		if (paddr == 0) {
+			lock_release(vm_lock);
+			return ENOMEM;
+		}
+		result = swap_in(PTE_SLOT(*pte), paddr);
+		if (result) {
+			coremap_decref(paddr);
+			lock_release(vm_lock);
+			return result;
+		}
+		/* Only unshared frames are paged out, so the copy is ours alone */
+		*pte = paddr | PTE_VALID | PTE_WRITE;
+		coremap_setowner(paddr, as, faultaddress);
+		vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+	} else if ((*pte & PTE_VALID) == 0 && !writeable && as->as_vnode != NULL &&
+		   (paddr = coremap_cache_lookup(as->as_vnode, faultaddress)) != 0) {
+		/* Another process running this program already loaded it */
+		*pte = paddr | PTE_VALID;
+		vmstats_inc(VMSTAT_TLB_RELOAD);
+	} else if ((*pte & PTE_VALID) == 0) {
+		/* First touch of this page: load it from the executable or zero it */
+		paddr = vm_alloc_upage();
+		if (paddr == 0) {
+			lock_release(vm_lock);
+			return ENOMEM;
+		}
+		result = vm_fill_page(as, faultaddress, paddr);
+		if (result) {
+			coremap_decref(paddr);
+			lock_release(vm_lock);
+			return result;
+		}
+		/* Only this process's own faults touch an unmapped PTE */
+		KASSERT(*pte == 0);
+		if (!writeable && as->as_vnode != NULL) {
+			/* Read-only pages are the same everywhere, so share them */
+			*pte = coremap_cache_insert(paddr, as->as_vnode,
+						    faultaddress) | PTE_VALID;
+			if ((*pte & PTE_FRAME) == paddr) {
+				coremap_setowner(paddr, as, faultaddress);
+			}
+		} else {
+			*pte = paddr | PTE_VALID | (writeable ? PTE_WRITE : 0);
+			coremap_setowner(paddr, as, faultaddress);
+		}
+	} else if (faulttype != VM_FAULT_READONLY) {
+		/* Page is in memory, it just fell out of the TLB */
+		vmstats_inc(VMSTAT_TLB_RELOAD);
+	}
 
-void
-vm_bootstrap(void)
-{
-	/* Do nothing. */
-}
+	/* Break copy-on-write sharing now rather than take a second fault for it */
+	if (faulttype != VM_FAULT_READ && (*pte & PTE_WRITE) == 0) {
+		result = vm_make_writable(as, faultaddress, pte);
+		if (result) {
+			lock_release(vm_lock);
+			return result;
+		}
+	}
 
-static
-paddr_t
-getppages(unsigned long npages)
-{
-	paddr_t addr;
+	paddr = *pte & PTE_FRAME;
 
-	spinlock_acquire(&stealmem_lock);
+	/* make sure it's page-aligned */
+	KASSERT((paddr & PAGE_FRAME) == paddr);
 
-	addr = ram_stealmem(npages);
-	
-	spinlock_release(&stealmem_lock);
-	return addr;
-}
+	/* Second chance for the clock, and back to an owner once no longer shared */
+	coremap_touch(paddr, as, faultaddress);
 
-/* Allocate/free some kernel-space virtual pages */
-vaddr_t 
-alloc_kpages(int npages)
-{
-	paddr_t pa;
-	pa = getppages(npages);
-	if (pa==0) {
-		return 0;
+	/* Shared and read-only pages stay read-only in the TLB so writes trap */
+	elo = paddr | TLBLO_VALID;
+	if (*pte & PTE_WRITE) {
+		elo |= TLBLO_DIRTY;
 	}
-	return PADDR_TO_KVADDR(pa);
-}
 
-void 
-free_kpages(vaddr_t addr)
-{
-	/* nothing - leak the memory. */
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x (asid %u)\n", faultaddress, paddr, as->as_asid);
+	vm_tlb_load(faultaddress | (as->as_asid << TLBHI_PIDSHIFT), elo);
 
-	(void)addr;
-}
+	lock_release(vm_lock);
 
-void
-vm_tlbshootdown_all(void)
-{
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	return 0;
 }
 
-void
-vm_tlbshootdown(const struct tlbshootdown *ts)
-{
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
-}
+#else
 
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
@@ -121,6 +920,12 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
+#ifdef OPT_A2
+		/* ...except the time page */
+		if (faultaddress == TIMEPAGE_VADDR) {
+			return EFAULT;
+		}
+#endif /* OPT_A2 */
 		/* We always create pages read-write, so we can't get this */
 		panic("dumbvm: got VM_FAULT_READONLY\n");
 	    case VM_FAULT_READ:
@@ -178,6 +983,11 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	else if (faultaddress >= stackbase && faultaddress < stacktop) {
 		paddr = (faultaddress - stackbase) + as->as_stackpbase;
 	}
+#ifdef OPT_A2
+	else if (faultaddress == TIMEPAGE_VADDR && faulttype == VM_FAULT_READ) {
+		paddr = timepage_paddr();
+	}
+#endif /* OPT_A2 */
 	else {
 		return EFAULT;
 	}
@@ -195,6 +1005,11 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		}
 		ehi = faultaddress;
 		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+#ifdef OPT_A2
+		if (faultaddress == TIMEPAGE_VADDR) {
+			elo &= ~TLBLO_DIRTY;
+		}
+#endif /* OPT_A2 */
 		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
 		tlb_write(ehi, elo, i);
 		splx(spl);
@@ -206,6 +1021,52 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	return EFAULT;
 }
 
+#endif /* OPT_A3 */
+
+#if OPT_A3
+
+struct addrspace *
+as_create(void)
+{
+	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	if (as==NULL) {
+		return NULL;
+	}
+
+	as->as_nregions = 0;
+	as->as_vnode = NULL;
+	as->as_stackbase = USERSTACK - PAGE_SIZE;
+	as->as_heapbase = 0;
+	as->as_heaptop = 0;
+
+	/* Gets a real ASID the first time it is activated */
+	as->as_asid = 0;
+	as->as_asid_generation = 0;
+
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+
+	return as;
+}
+
+void
+as_destroy(struct addrspace *as)
+{
+	/* Gives every frame and swap slot the process used back */
+	lock_acquire(vm_lock);
+	pt_destroy(as->as_pt);
+	lock_release(vm_lock);
+	if (as->as_vnode != NULL) {
+		VOP_DECREF(as->as_vnode);
+	}
+	kfree(as);
+}
+
+#else
+
 struct addrspace *
 as_create(void)
 {
@@ -231,6 +1092,56 @@ as_destroy(struct addrspace *as)
 	kfree(as);
 }
 
+#endif /* OPT_A3 */
+
+#if OPT_A3
+
+void
+as_activate(void)
+{
+	int i, spl;
+	struct addrspace *as;
+	uint32_t generation;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/* Kernel threads don't have an address spaces to activate */
+		return;
+	}
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	spinlock_acquire(&asid_lock);
+	if (as->as_asid_generation != asid_generation) {
+		if (asid_next == NUM_ASID) {
+			/* Out of ASIDs: everyone's current one is now stale */
+			asid_generation++;
+			asid_next = ASID_FIRST;
+		}
+		as->as_asid = asid_next++;
+		as->as_asid_generation = asid_generation;
+	}
+	generation = asid_generation;
+	spinlock_release(&asid_lock);
+
+	/* Entries from the last generation may be tagged with reissued ASIDs */
+	if (curcpu->c_asid_generation != generation) {
+		for (i=0; i<NUM_TLB; i++) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+		curcpu->c_asid_generation = generation;
+		vmstats_inc(VMSTAT_TLB_INVALIDATE);
+	}
+
+	curcpu->c_asid = as->as_asid;
+	tlb_setasid(as->as_asid);
+
+	splx(spl);
+}
+
+#else
+
 void
 as_activate(void)
 {
@@ -255,12 +1166,92 @@ as_activate(void)
 	splx(spl);
 }
 
+#endif /* OPT_A3 */
+
 void
 as_deactivate(void)
 {
 	/* nothing */
 }
 
+#if OPT_A3
+
+int
+as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		 int readable, int writeable, int executable)
+{
+	size_t npages; 
+
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = sz / PAGE_SIZE;
+
+	/* The MIPS can't stop reads or execution, only writes */
+	(void)readable;
+	(void)executable;
+
+	/* Nothing copies the segment in with uiomove anymore to catch this */
+	if (vaddr >= USERSPACETOP || sz > USERSPACETOP - vaddr) {
+		return EFAULT;
+	}
+
+	if (as->as_nregions == AS_MAXREGIONS) {
+		kprintf("dumbvm: Warning: too many regions\n");
+		return EUNIMP;
+	}
+
+	as->as_regions[as->as_nregions].ar_vbase = vaddr;
+	as->as_regions[as->as_nregions].ar_npages = npages;
+	as->as_regions[as->as_nregions].ar_writeable = writeable != 0;
+	as->as_regions[as->as_nregions].ar_fileoff = 0;
+	as->as_regions[as->as_nregions].ar_filevaddr = vaddr;
+	as->as_regions[as->as_nregions].ar_filesize = 0;
+	as->as_nregions++;
+
+	return 0;
+}
+
+int
+as_define_file(struct addrspace *as, struct vnode *v,
+	       off_t offset, vaddr_t vaddr, size_t filesize)
+{
+	struct as_region *ar;
+
+	ar = as_find_region(as, vaddr);
+	if (ar == NULL ||
+	    filesize > ar->ar_vbase + ar->ar_npages * PAGE_SIZE - vaddr) {
+		return EINVAL;
+	}
+
+	/* Every region comes from the same executable */
+	if (as->as_vnode == NULL) {
+		VOP_INCREF(v);
+		as->as_vnode = v;
+	}
+	KASSERT(as->as_vnode == v);
+
+	ar->ar_fileoff = offset;
+	ar->ar_filevaddr = vaddr;
+	ar->ar_filesize = filesize;
+
+	return 0;
+}
+
+int
+as_prepare_load(struct addrspace *as)
+{
+	/* Nothing to reserve or load: vm_fault does it page by page */
+	KASSERT(as->as_pt != NULL);
+	return 0;
+}
+
+#else
+
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 		 int readable, int writeable, int executable)
@@ -336,130 +1327,276 @@ as_prepare_load(struct addrspace *as)
 	return 0;
 }
 
+#endif /* OPT_A3 */
+
 int
 as_complete_load(struct addrspace *as)
 {
+#if OPT_A3
+	unsigned i;
+	vaddr_t vtop;
+
+	/* The heap starts out empty, just past the highest segment */
+	as->as_heapbase = 0;
+	for (i = 0; i < as->as_nregions; i++) {
+		vtop = as->as_regions[i].ar_vbase +
+			as->as_regions[i].ar_npages * PAGE_SIZE;
+		if (vtop > as->as_heapbase) {
+			as->as_heapbase = vtop;
+		}
+	}
+	as->as_heaptop = as->as_heapbase;
+#else
 	(void)as;
+#endif /* OPT_A3 */
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
+#if OPT_A3
+	/* One page to start with; vm_fault grows it as it's used */
+	KASSERT(as->as_pt != NULL);
+	KASSERT(as->as_stackbase == USERSTACK - PAGE_SIZE);
+#else
 	KASSERT(as->as_stackpbase != 0);
+#endif /* OPT_A3 */
 
 	*stackptr = USERSTACK;
 	return 0;
 }
 
-#ifdef OPT_A2
-int 		  
-as_define_stack_args(struct addrspace *as, userptr_t *argv, vaddr_t *initstackptr, char **args, int argc)
+#if OPT_A3
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldtop)
 {
-	KASSERT(as->as_stackpbase != 0);
+	vaddr_t old, new, vaddr;
+	pte_t *pte;
 
-	int result;
+	old = as->as_heaptop;
 
-	/* We need to keep track of the addresses where we store the strings */
-	int arg_addresses[argc];
+	/* The heap can't shrink below its start or grow into the stack's space */
+	if (amount < 0 && -(vaddr_t)amount > old - as->as_heapbase) {
+		return EINVAL;
+	}
+	if (amount > 0 && (vaddr_t)amount > DUMBVM_HEAPLIMIT - old) {
+		return ENOMEM;
+	}
+	new = old + amount;
 
-	/* First copy the strings arguments (including the program name at round argc) */
-	for(int i = 0; i < argc; ++i)
-	{
-		const char *s = args[i];
+	if (ROUNDUP(new, PAGE_SIZE) < ROUNDUP(old, PAGE_SIZE)) {
+		lock_acquire(vm_lock);
 
-		int n = strlen(s);
+		/*
+		 * As in as_copy, one shootdown of the whole ASID rather
+		 * than one per page. It has to happen before the frames
+		 * go back to the coremap; nothing can fault them back in
+		 * meanwhile, since we're the only thread in AS.
+		 */
+		KASSERT(as == curproc_getas());
+		vm_tlb_shootdown_as(as);
+
+		/* Give back every page that is no longer in the heap */
+		for (vaddr = ROUNDUP(new, PAGE_SIZE);
+		     vaddr < ROUNDUP(old, PAGE_SIZE);
+		     vaddr += PAGE_SIZE) {
+			pte = pt_lookup(as->as_pt, vaddr, false);
+			if (pte == NULL) {
+				continue;
+			}
+			if (*pte & PTE_VALID) {
+				coremap_decref(*pte & PTE_FRAME);
+			} else if (*pte & PTE_SWAPPED) {
+				swap_free(PTE_SLOT(*pte));
+			}
+			*pte = 0;
+		}
 
-		/* Warning: remember that we need to push strlen(s) + 1 bytes on to the stack, because
-		 * strlen does not take into account the null character */
+		as->as_heaptop = new;
+		lock_release(vm_lock);
+	} else {
+		as->as_heaptop = new;
+	}
 
-		/* Write up to and including 0x7FFF FFFF, but not USERSTACK = 0x8000 0000 */
-		int starting_address;
+	DEBUG(DB_VM, "dumbvm: sbrk(%d): break 0x%x -> 0x%x\n", (int)amount, old, new);
 
-		if(i == 0){
-			starting_address = USERSTACK;
-		} else {
-			starting_address = arg_addresses[i-1];
-		}
+	*oldtop = old;
+	return 0;
+}
 
-		int arg_address = starting_address - (n + 1);
+int
+as_lendpage(struct addrspace *as, vaddr_t vaddr, paddr_t *paddr)
+{
+	pte_t *pte;
 
-		DEBUG(DB_SYSCALL, "as_define_stack_args | writing argument %s to address %p\n", s, (int *) arg_address);
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	if (!as_valid_address(as, vaddr)) {
+		return EFAULT;
+	}
+	/* Read-only pages may be in the page cache, which keys on their vaddr */
+	if (!as_writeable(as, vaddr)) {
+		return EAGAIN;
+	}
 
-		size_t actual_len = -1;
-		result = copyoutstr(s, (userptr_t) arg_address, n+1, &actual_len);
+	lock_acquire(vm_lock);
 
-		if(result){
-			DEBUG(DB_SYSCALL, "as_define_stack_args | ERROR:%d could not write arguemnt %s to user address %p\n", result, s, (int *) arg_address);
-			return result;
-		}
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	if (pte == NULL || (*pte & PTE_VALID) == 0) {
+		lock_release(vm_lock);
+		return EAGAIN;
+	}
 
-		arg_addresses[i] = arg_address;
-		//DEBUG(DB_SYSCALL, "as_define_stack_args | arg_addresses[%d]:%p str:%s\n", i, (int *) arg_address, (char *) arg_address);
+	/* From now on a write has to fault and take a copy, as after fork */
+	if (*pte & PTE_WRITE) {
+		*pte &= ~PTE_WRITE;
+		vm_tlb_shootdown(as, vaddr);
 	}
 
-	/* Next, copy the pointers to the strings */
+	*paddr = *pte & PTE_FRAME;
+	coremap_incref(*paddr);
 
-	int ptr_address = arg_addresses[argc-1];
+	lock_release(vm_lock);
+	return 0;
+}
 
-	/* For debugging: print the stack */
-	for(size_t j = arg_addresses[argc-1]; j < USERSTACK; ++j)
-	{
-		DEBUG(DB_SYSCALL, " as_define_stack_args | %p:%c\n", (int *) j, *((char *) j));
-	}
+int
+as_mappage(struct addrspace *as, vaddr_t vaddr, paddr_t paddr)
+{
+	pte_t *pte;
+	pte_t old;
 
-	for(int i = -1; i < argc; ++i)
-	{
-		if(i == -1) {
-			/* Make sure the address of terminating null pointer is divisible by 8 
-			 * (and leave some extra room to avoid overwriting a string) */
-			int offset = (ptr_address % 8 == 0) ? 8 : 16;
-			ptr_address = ROUNDUP(ptr_address - offset, 8);
-		} else {
-			/* For addresses holding a (char *), they can be divisible by 4 */
-			ptr_address = ROUNDUP(ptr_address - 4, 4);
-		}
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
 
-		int *address = (int *) ptr_address;
+	if (!as_valid_address(as, vaddr) || !as_writeable(as, vaddr)) {
+		return EFAULT;
+	}
 
-		/* We write NULL to the stack first, so arguments is an array of pointers that are NULL terminated */
-		int src = (i == -1) ? 0 : arg_addresses[argc-i-1];
+	lock_acquire(vm_lock);
 
-		DEBUG(DB_SYSCALL, "as_define_stack_args | writing %p to address %p\n", (int *) src, address);
+	/* PADDR is shared, so it can't be paged out if this evicts */
+	pte = pt_lookup(as->as_pt, vaddr, true);
+	if (pte == NULL) {
+		lock_release(vm_lock);
+		return ENOMEM;
+	}
 
-		result = copyout((const void *) &src, (userptr_t) address, sizeof(int));
-	
-		if(result){
-			DEBUG(DB_SYSCALL, "as_define_stack_args | ERROR:%d could not copy arg %d to user address %p\n", result, src, address);
-		}
+	old = *pte;
+	*pte = paddr | PTE_VALID;
+	vm_tlb_shootdown(as, vaddr);
 
-		DEBUG(DB_SYSCALL, "as_define_stack_args | address:%p *address:%p (char *)*address:%s\n", address, (int *) *address, (char *) *address);
+	if (old & PTE_VALID) {
+		coremap_decref(old & PTE_FRAME);
+	} else if (old & PTE_SWAPPED) {
+		swap_free(PTE_SLOT(old));
 	}
 
+	DEBUG(DB_VM, "dumbvm: map 0x%x -> 0x%x (asid %u)\n", vaddr, paddr, as->as_asid);
+
+	lock_release(vm_lock);
+	return 0;
+}
+
+#endif /* OPT_A3 */
 
-	/* Set the userspace args pointer */
-	*argv = (userptr_t) ptr_address;
+#ifdef OPT_A2
+int
+as_define_stack_args(struct addrspace *as, char *argbuf, size_t arglen, int argc,
+		     userptr_t *argv, vaddr_t *initstackptr)
+{
+#if OPT_A3
+	/* Stack pages get faulted in by the copyout below */
+	KASSERT(as->as_pt != NULL);
+#else
+	KASSERT(as->as_stackpbase != 0);
+#endif /* OPT_A3 */
 
-	/* Set the stack pointer to the top of the user stack, but make sure it is divisible by 8 */
-	vaddr_t	user_stack_ptr = (vaddr_t) (ptr_address % 8 == 0) ? ptr_address : ROUNDUP(ptr_address - 8, 8);
-	*initstackptr = user_stack_ptr;
+	vaddr_t *ptrs = (vaddr_t *) argbuf;
+	vaddr_t base;
+	int result;
 
-	if(result){
-		DEBUG(DB_SYSCALL, "as_define_stack_args | ERROR:%d could not copy arguments to user address\n", result);
-		return result;
+	KASSERT(arglen >= (argc + 1) * sizeof(vaddr_t));
+	KASSERT(ptrs[argc] == 0);
+
+	/* The whole block goes at the top of the stack, 8-byte aligned */
+	base = (USERSTACK - arglen) & ~(vaddr_t)7;
+
+	/* Turn the offsets into the strings into user pointers */
+	for (int i = 0; i < argc; ++i) {
+		ptrs[i] += base;
 	}
 
-	/* For debugging purposes */
-	char **argv_debug = (char **) ptr_address;
-	for(int j = 0; j < argc; ++j)
-	{
-		DEBUG(DB_SYSCALL, "as_define_stack_args | &argv[%d]:%p argv[%d]:%p *argv[%d]:%s\n", j, argv_debug + j, j, (int *) argv_debug[j], j, (char *) argv_debug[j]);
+	result = copyout(argbuf, (userptr_t) base, arglen);
+	if (result) {
+		DEBUG(DB_SYSCALL, "as_define_stack_args | ERROR:%d could not copy %u bytes of arguments to %p\n", result, arglen, (void *) base);
+		return result;
 	}
 
+	DEBUG(DB_SYSCALL, "as_define_stack_args | %d arguments, %u bytes at %p\n", argc, arglen, (void *) base);
+
+	/* argv is the bottom of the block, and so is the stack */
+	*argv = (userptr_t) base;
+	*initstackptr = base;
+
 	return 0;
 }
 #endif //OPT_A2
 
+#if OPT_A3
+
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
+{
+	struct addrspace *new;
+	unsigned i;
+	int result;
+
+	new = as_create();
+	if (new==NULL) {
+		return ENOMEM;
+	}
+
+	for (i = 0; i < old->as_nregions; i++) {
+		new->as_regions[i] = old->as_regions[i];
+	}
+	new->as_nregions = old->as_nregions;
+	new->as_stackbase = old->as_stackbase;
+	new->as_heapbase = old->as_heapbase;
+	new->as_heaptop = old->as_heaptop;
+
+	/* Pages neither side has touched yet still come from the executable */
+	if (old->as_vnode != NULL) {
+		VOP_INCREF(old->as_vnode);
+		new->as_vnode = old->as_vnode;
+	}
+
+	/*
+	 * Share every page copy-on-write instead of copying it. The
+	 * parent's pages are read-only now, but the TLB of any CPU it
+	 * ran on may still hold writable entries for them. Rather than
+	 * shoot those down a page at a time, clear the parent's ASID out
+	 * of every TLB at once, so its next write to a shared page traps.
+	 * (Even if pt_copy fails part way, some pages are shared.) The
+	 * parent keeps its ASID, so forking doesn't use ASIDs up.
+	 */
+	KASSERT(old == curproc_getas());
+	lock_acquire(vm_lock);
+	result = pt_copy(old->as_pt, new->as_pt);
+	vm_tlb_shootdown_as(old);
+	lock_release(vm_lock);
+	if (result) {
+		as_destroy(new);
+		return result;
+	}
+
+	*ret = new;
+	return 0;
+}
+
+#else
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -500,3 +1637,5 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	*ret = new;
 	return 0;
 }
+
+#endif /* OPT_A3 */
@@ -50,6 +50,11 @@
  */
 #define CPU_FREQUENCY 25000000 /* 25 MHz */
 
+#ifdef OPT_A2
+/* Hardclocks per second on an idle cpu; see mainbus_idleclock */
+#define IDLE_HZ 1
+#endif
+
 /*
  * Access to the on-chip timer.
  *
@@ -125,6 +130,18 @@ mainbus_start_cpus(void)
 	lamebus_start_cpus(lamebus);
 }
 
+#ifdef OPT_A2
+void
+mainbus_idleclock(bool idle)
+{
+	/* interrupts should be off, so the handler can't see it half done */
+	KASSERT(curthread->t_curspl > 0);
+
+	curcpu->c_idleclock = idle;
+	mips_timer_set(CPU_FREQUENCY / (idle ? IDLE_HZ : HZ));
+}
+#endif
+
 /*
  * Function to generate the memory address (in the uncached segment)
  * for the specified offset into the specified slot's region of the
@@ -269,7 +286,12 @@ mainbus_interrupt(struct trapframe *tf)
 	}
 	else if (cause & MIPS_TIMER_BIT) {
 		/* Reset the timer (this clears the interrupt) */
+#ifdef OPT_A2
+		mips_timer_set(CPU_FREQUENCY /
+			       (curcpu->c_idleclock ? IDLE_HZ : HZ));
+#else
 		mips_timer_set(CPU_FREQUENCY / HZ);
+#endif
 		/* and call hardclock */
 		hardclock();
 	}
@@ -37,8 +37,12 @@
 
 #include <vm.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 struct vnode;
+#if OPT_A3
+struct pagetable;
+#endif /* OPT_A3 */
 
 
 /* 
@@ -48,6 +52,39 @@ struct vnode;
  * You write this.
  */
 
+#if OPT_A3
+
+/*
+ * One segment of the executable, as given to as_define_region. Its
+ * pages are read in from the executable when they are first touched:
+ * ar_filesize bytes at ar_fileoff in as_vnode belong at ar_filevaddr,
+ * and the rest of the segment is zero.
+ */
+struct as_region {
+  vaddr_t ar_vbase;		/* page-aligned start */
+  size_t ar_npages;
+  bool ar_writeable;		/* text and read-only data are not */
+  off_t ar_fileoff;		/* where the contents are in the executable */
+  vaddr_t ar_filevaddr;		/* where they go (not page-aligned) */
+  size_t ar_filesize;		/* 0 if the segment is all zeros */
+};
+
+#define AS_MAXREGIONS 4
+
+struct addrspace {
+  struct as_region as_regions[AS_MAXREGIONS];
+  unsigned as_nregions;
+  struct pagetable *as_pt;	/* pages are allocated on first fault */
+  struct vnode *as_vnode;	/* executable the regions are loaded from */
+  vaddr_t as_stackbase;		/* lowest page the stack has grown down to */
+  vaddr_t as_heapbase;		/* page after the last segment */
+  vaddr_t as_heaptop;		/* the break; not necessarily page-aligned */
+  uint32_t as_asid;		/* TLB address space ID */
+  uint32_t as_asid_generation;	/* as_asid is only good in this generation */
+};
+
+#else
+
 struct addrspace {
   vaddr_t as_vbase1;
   paddr_t as_pbase1;
@@ -58,6 +95,8 @@ struct addrspace {
   paddr_t as_stackpbase;
 };
 
+#endif /* OPT_A3 */
+
 /*
  * Functions in addrspace.c:
  *
@@ -83,6 +122,10 @@ struct addrspace {
  *    as_define_region - set up a region of memory within the address
  *                space.
  *
+ *    as_define_file - say where in the executable the contents of the
+ *                region containing VADDR are. (A3 only: the pages are
+ *                read in on demand by vm_fault rather than by load_elf.)
+ *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
  *
@@ -92,6 +135,19 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_sbrk   - move the end of the heap, which starts right after
+ *                the last segment, by AMOUNT bytes. Hands back the
+ *                old end. (A3 only.)
+ *
+ *    as_lendpage - share the page at VADDR copy-on-write and hand back
+ *                its frame, with a reference for the caller. Fails
+ *                with EAGAIN if the page isn't in memory or is in a
+ *                read-only segment. (A3 only: for pipes.)
+ *
+ *    as_mappage - map the frame PADDR at VADDR copy-on-write, in place
+ *                of whatever was there, taking over the caller's
+ *                reference. VADDR must be writeable. (A3 only.)
  */
 
 struct addrspace *as_create(void);
@@ -105,17 +161,38 @@ int               as_define_region(struct addrspace *as,
                                    int readable, 
                                    int writeable,
                                    int executable);
+#if OPT_A3
+int               as_define_file(struct addrspace *as, struct vnode *v,
+                                 off_t offset, vaddr_t vaddr,
+                                 size_t filesize);
+#endif
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if OPT_A3
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldtop);
+int               as_lendpage(struct addrspace *as, vaddr_t vaddr,
+                              paddr_t *paddr);
+int               as_mappage(struct addrspace *as, vaddr_t vaddr,
+                             paddr_t paddr);
+#endif
 
 #ifdef OPT_A2
-/* Set the stack pointer as well as put arguments on the stack, for execv or runprogram*/
+/*
+ * Set the stack pointer as well as put arguments on the stack, for execv or runprogram.
+ *
+ * ARGBUF holds the arguments packed the way they go on the stack: ARGC+1
+ * words, being the offset within ARGBUF of each string and then 0,
+ * followed by the strings. It is ARGLEN bytes long and is changed in
+ * place; the whole thing goes to the user stack in one copyout.
+ */
 int 		  as_define_stack_args(struct addrspace *as, 
+					char *argbuf,
+					size_t arglen,
+					int argc,
 					userptr_t *argv, 
-					vaddr_t *initstackptr, 
-					char **args, 
-					int argc);
+					vaddr_t *initstackptr);
 #endif //OPT_A2
 
 
@@ -0,0 +1,48 @@
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: calling a function some time from now.
+ *
+ * The caller provides the struct callout, and it has to stay put until
+ * the callout has gone off or been cancelled. The function is called
+ * from the timer interrupt, on one cpu, so it must not sleep; it may
+ * schedule callouts, including its own again.
+ *
+ * Callouts are kept in a timer wheel (see callout.c), so scheduling,
+ * cancelling and each timer tick take constant time no matter how many
+ * are pending. The resolution is one timer tick, LT_GRANULARITY usec;
+ * a callout never goes off early, and goes off within a tick after
+ * when it was asked for, as far as the wheel can see (about a week),
+ * after which it goes off at the far end.
+ */
+
+struct callout {
+	struct callout *co_next;	/* next in its wheel slot */
+	struct callout **co_prevp;	/* what points to it; NULL if not pending */
+	void (*co_func)(void *);	/* what to call */
+	void *co_arg;			/* and what with */
+	uint32_t co_expires;		/* timer tick it is due at */
+};
+
+/* Set up a callout that isn't pending. */
+void callout_init(struct callout *co);
+
+/*
+ * Call FUNC(ARG) in USEC microseconds. If CO is pending already it is
+ * moved to the new time.
+ */
+void callout_schedule(struct callout *co, void (*func)(void *), void *arg,
+		      unsigned usec);
+
+/*
+ * Make sure CO won't go off. If it is going off right now on another
+ * cpu, waits for it to finish, so afterwards the struct callout can be
+ * reused or freed. Returns true if it was still pending.
+ */
+bool callout_cancel(struct callout *co);
+
+/* Run whatever is due. Called from timerclock() every tick. */
+void callout_tick(void);
+
+#endif /* _CALLOUT_H_ */
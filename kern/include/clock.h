@@ -31,6 +31,7 @@
 #define _CLOCK_H_
 
 #include "opt-synchprobs.h"
+#include "opt-A2.h"
 
 /*
  * Time-related definitions.
@@ -83,5 +84,27 @@ void clocksleep(int seconds);
  */
 void clocknap(int ticks);
 
+#ifdef OPT_A2
+/*
+ * The time page (see <kern/timepage.h>). timepage_bootstrap() sets it
+ * up once the clock device is attached, and timerclock() keeps it
+ * current after that. timepage_paddr() is its frame, for vm_fault.
+ *
+ * gettime_coarse() is gettime() as of the last timer tick, which is
+ * much cheaper. getboottime() is the time of day the system booted.
+ */
+void timepage_bootstrap(void);
+paddr_t timepage_paddr(void);
+void gettime_coarse(time_t *seconds, uint32_t *nanoseconds);
+void getboottime(time_t *seconds, uint32_t *nanoseconds);
+
+/*
+ * clocksleep_usec() sleeps for USEC microseconds, rounded up to a
+ * timer tick. Like clocksleep() and clocknap(), it wakes just once,
+ * at the end (see callout.h).
+ */
+void clocksleep_usec(unsigned usec);
+#endif /* OPT_A2 */
+
 
 #endif /* _CLOCK_H_ */
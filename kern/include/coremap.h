@@ -0,0 +1,117 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Coremap - bookkeeping for every physical page frame that the VM
+ * system gets from ram_getsize().
+ *
+ * Frames are handed out one at a time to user address spaces (from
+ * vm_fault) and in physically contiguous runs to the kernel (from
+ * alloc_kpages). Both kinds are returned to the free pool when they
+ * are freed, unlike ram_stealmem which can never give memory back.
+ *
+ * User frames are reference counted so that fork can share them
+ * copy-on-write between parent and child. A shared frame has no single
+ * owner; whichever process is left holding the last reference claims
+ * it back when it next faults on it, in coremap_touch (or with
+ * coremap_setowner, if it is writing to it).
+ *
+ * Only frames with an owner can be paged out, since the owner's page
+ * table is the one that has to be told. That also keeps a freshly
+ * allocated frame in place until whoever asked for it has mapped it.
+ *
+ * Pages of read-only segments are the same in every process running a
+ * given executable, so they can go in the page cache, keyed by the
+ * executable's vnode and the page's virtual address. A later process
+ * faulting on the same page maps the cached frame instead of reading
+ * the file again. The cache holds no references of its own: a frame
+ * leaves it when the last page table mapping it lets go, and since
+ * each of those address spaces holds a reference to the vnode, a
+ * vnode in the cache is always still alive.
+ *
+ * Memory stolen with ram_stealmem before coremap_bootstrap() runs is
+ * not managed here and is never reclaimed.
+ */
+
+#include "opt-A3.h"
+
+#if OPT_A3
+
+struct addrspace;
+struct vnode;
+
+/* Frame states */
+#define CM_FREE     0	/* not in use, available for allocation */
+#define CM_KERNEL   1	/* part of a block returned by alloc_kpages */
+#define CM_USER     2	/* a page mapped into some user address space */
+
+struct coremap_entry {
+	unsigned cme_state;		/* CM_FREE, CM_KERNEL or CM_USER */
+	unsigned cme_npages;		/* length of the kernel block starting here */
+	unsigned cme_refcount;		/* page tables mapping a CM_USER frame */
+	struct addrspace *cme_as;	/* owner of an unshared CM_USER frame */
+	vaddr_t cme_vaddr;		/* where the owner has it mapped */
+	bool cme_referenced;		/* used since the clock hand last passed */
+	struct vnode *cme_vnode;	/* executable, if in the page cache */
+	unsigned cme_cachenext;		/* next in hash chain, plus 1 (0 for none) */
+};
+
+/* Take over physical memory management from ram_stealmem. */
+void coremap_bootstrap(void);
+
+/* True once coremap_bootstrap has run. */
+bool coremap_isready(void);
+
+/* Allocate NPAGES physically contiguous frames for the kernel. Returns 0 if none. */
+paddr_t coremap_alloc_kpages(unsigned npages);
+
+/* Allocate one frame, without an owner yet, for a user page. Returns 0 if none. */
+paddr_t coremap_alloc_upage(void);
+
+/* Return a kernel block to the free pool. */
+void coremap_free(paddr_t paddr);
+
+/* Add a reference to a user frame that is now shared copy-on-write. */
+void coremap_incref(paddr_t paddr);
+
+/* Drop a reference to a user frame, freeing it when the last one goes. */
+void coremap_decref(paddr_t paddr);
+
+/* Number of page tables currently mapping a user frame. */
+unsigned coremap_refcount(paddr_t paddr);
+
+/* Record that AS is now the only user of a frame, at VADDR. */
+void coremap_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+
+/*
+ * Look up page VADDR of executable V in the page cache. If it's there,
+ * add a reference to the frame for the caller and return it; if not,
+ * return 0.
+ */
+paddr_t coremap_cache_lookup(struct vnode *v, vaddr_t vaddr);
+
+/*
+ * Add the freshly loaded frame PADDR to the page cache as page VADDR
+ * of executable V. If someone else cached that page in the meantime,
+ * PADDR is freed and their frame is returned with a reference added
+ * instead; otherwise PADDR is returned.
+ */
+paddr_t coremap_cache_insert(paddr_t paddr, struct vnode *v, vaddr_t vaddr);
+
+/*
+ * Note that AS has just used the user frame PADDR, which it has mapped
+ * at VADDR (for the clock). If AS is the only one left mapping it, AS
+ * becomes its owner again, so it can be paged out.
+ */
+void coremap_touch(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+
+/*
+ * Pick an owned user frame to page out, clock (second chance) order.
+ * Returns 0 if there is none; otherwise the owner and where it has the
+ * frame mapped come back in *AS and *VADDR.
+ */
+paddr_t coremap_victim(struct addrspace **as, vaddr_t *vaddr);
+
+#endif /* OPT_A3 */
+
+#endif /* _COREMAP_H_ */
@@ -34,6 +34,15 @@
 #include <spinlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include "opt-A2.h"
+#include "opt-A3.h"
+
+#ifdef OPT_A2
+struct syscall_stats;
+
+/* Number of scheduler priority levels, each with its own run queue */
+#define SCHED_NLEVELS 4
+#endif
 
 
 /*
@@ -60,13 +69,39 @@ struct cpu {
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+#if OPT_A3
+	uint32_t c_asid_generation;	/* ASID generation of this cpu's TLB contents */
+	uint32_t c_asid;		/* ASID last loaded into this cpu's EntryHi */
+#endif
+#ifdef OPT_A2
+	struct syscall_stats *c_syscallstats;	/* System calls made on this cpu */
+	unsigned c_quantum;		/* Hardclocks in a level-0 quantum
+					   (the menu may set it too) */
+	bool c_idleclock;		/* Hardclock slowed down for idling */
+
+	/*
+	 * Exited threads kept, stack and all, for thread_fork to reuse
+	 * (see thread.c). Only touched at splhigh.
+	 */
+	struct threadlist c_threadcache;
+	unsigned c_threadcache_hits;	/* thread_fork took one from it */
+	unsigned c_threadcache_misses;	/* thread_fork found it empty */
+	unsigned c_threadcache_puts;	/* exited threads kept */
+	unsigned c_threadcache_frees;	/* exited threads freed; it was full */
+#endif
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
+#ifdef OPT_A2
+	struct threadlist c_runqueue[SCHED_NLEVELS]; /* Run queues, by t_level */
+	volatile unsigned c_runcount;	/* Threads on all of them; may be
+					   read without the lock, as a hint */
+#else
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
+#endif
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -152,6 +187,8 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_broadcast sends the same shootdown to all CPUs
+ * except the current one, and returns how many that was.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -166,6 +203,9 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+#if OPT_A3
+unsigned ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping);
+#endif
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,91 @@
+#ifndef _FILETABLE_H_
+#define _FILETABLE_H_
+
+/*
+ * Open files and per-process file descriptor tables.
+ *
+ * An openfile is what open() creates: a vnode plus the access mode and
+ * the current offset. Descriptors refer to openfiles, and more than
+ * one descriptor can refer to the same one - after dup2, or in a parent
+ * and child after fork - in which case they share the offset, as in
+ * Unix. Openfiles are reference counted, one per descriptor, and the
+ * vnode is closed when the last descriptor goes.
+ *
+ * of_lock is held across each read, write and seek, so two processes
+ * sharing an openfile see its offset move atomically. (Pipes have no
+ * offset and do their own locking, so reads and writes skip it.)
+ *
+ * A filetable belongs to a single process, and processes have only one
+ * thread, so the table itself needs no lock.
+ */
+
+#include <limits.h>
+#include <spinlock.h>
+#include "opt-A2.h"
+
+#ifdef OPT_A2
+
+struct vnode;
+struct lock;
+
+struct openfile {
+	struct vnode *of_vnode;
+	int of_accmode;			/* O_RDONLY, O_WRONLY or O_RDWR */
+	bool of_append;			/* opened with O_APPEND */
+	off_t of_offset;		/* protected by of_lock */
+	struct lock *of_lock;
+	struct spinlock of_reflock;	/* protects of_refcount */
+	unsigned of_refcount;		/* descriptors referring to this */
+};
+
+struct filetable {
+	struct openfile *ft_files[OPEN_MAX];
+};
+
+/* Open PATH (which may be modified) and return a new openfile with one reference. */
+int openfile_open(char *path, int flags, mode_t mode, struct openfile **ret);
+
+/*
+ * Make an openfile for a vnode that is already open (a pipe end, say),
+ * taking over the caller's reference to it.
+ */
+int openfile_create(struct vnode *v, int flags, struct openfile **ret);
+
+/* Add a reference to an openfile. */
+void openfile_incref(struct openfile *of);
+
+/* Drop a reference to an openfile, closing it when the last one goes. */
+void openfile_decref(struct openfile *of);
+
+/* Create an empty descriptor table. Returns NULL if out of memory. */
+struct filetable *filetable_create(void);
+
+/* Close every descriptor in a table and free it. */
+void filetable_destroy(struct filetable *ft);
+
+/* Make a new table sharing all of FT's openfiles, for fork. */
+int filetable_copy(struct filetable *ft, struct filetable **ret);
+
+/* Open the console on descriptors 0, 1 and 2. */
+int filetable_openstd(struct filetable *ft);
+
+/* Look up descriptor FD. Returns EBADF if it isn't open. */
+int filetable_get(struct filetable *ft, int fd, struct openfile **ret);
+
+/*
+ * Put OF in the lowest free descriptor and return it in *FD. The
+ * table takes over the caller's reference. Returns EMFILE if full.
+ */
+int filetable_place(struct filetable *ft, struct openfile *of, int *fd);
+
+/*
+ * Put OF in descriptor FD, which must be in range, taking over the
+ * caller's reference. Whatever was there before is returned in *OLDOF
+ * (NULL if nothing) for the caller to decref.
+ */
+void filetable_set(struct filetable *ft, int fd, struct openfile *of,
+		   struct openfile **oldof);
+
+#endif /* OPT_A2 */
+
+#endif /* _FILETABLE_H_ */
@@ -0,0 +1,64 @@
+#ifndef _KERN_IORING_H_
+#define _KERN_IORING_H_
+
+/*
+ * Batched I/O: a submission ring and a completion ring in user memory,
+ * both worked through by one ioring_enter() system call, so a program
+ * doing lots of small reads and writes traps once per batch instead of
+ * once per call.
+ *
+ * The program fills in submission entries at ir_sqtail, moving it on
+ * as it goes. ioring_enter runs them in order from ir_sqhead, posts a
+ * completion entry for each at ir_cqtail, and moves both on. The
+ * program takes the completions from ir_cqhead and moves that on. The
+ * four counters only ever go up; an entry's slot is its counter modulo
+ * ir_entries, which must be a power of 2 no bigger than
+ * IORING_MAXENTRIES.
+ *
+ * ioring_enter returns how many entries it ran, stopping early if the
+ * completion ring is full. An entry that fails posts its error in
+ * cqe_error, and the ones after it still run.
+ */
+
+#define IORING_OP_READ   0	/* read(sqe_fd, sqe_buf, sqe_len) */
+#define IORING_OP_WRITE  1	/* write(sqe_fd, sqe_buf, sqe_len) */
+#define IORING_OP_LSEEK  2	/* lseek(sqe_fd, sqe_off, sqe_whence) */
+
+#define IORING_MAXENTRIES 1024
+
+struct ioring_sqe {
+	__i64 sqe_off;
+	__i32 sqe_op;			/* IORING_OP_* */
+	__i32 sqe_fd;
+#ifdef _KERNEL
+	userptr_t sqe_buf;
+#else
+	void *sqe_buf;
+#endif
+	__u32 sqe_len;
+	__i32 sqe_whence;
+	__u32 sqe_data;			/* anything; copied to the completion */
+};
+
+struct ioring_cqe {
+	__i64 cqe_result;		/* bytes read or written, or the new offset */
+	__u32 cqe_data;			/* sqe_data of the entry */
+	__i32 cqe_error;		/* 0, or the errno */
+};
+
+struct ioring {
+	volatile __u32 ir_sqhead;	/* moved on by the kernel */
+	volatile __u32 ir_sqtail;	/* moved on by the program */
+	volatile __u32 ir_cqhead;	/* moved on by the program */
+	volatile __u32 ir_cqtail;	/* moved on by the kernel */
+	__u32 ir_entries;		/* size of both rings */
+#ifdef _KERNEL
+	userptr_t ir_sq;
+	userptr_t ir_cq;
+#else
+	struct ioring_sqe *ir_sq;
+	struct ioring_cqe *ir_cq;
+#endif
+};
+
+#endif /* _KERN_IORING_H_ */
@@ -50,6 +50,16 @@ struct timespec {
         __i32 tv_nsec;          /* nanoseconds */
 };
 
+/*
+ * Clocks for clock_gettime. The _COARSE ones are only as fine as the
+ * timer tick, but reading them doesn't need a system call (see
+ * <kern/timepage.h>).
+ */
+#define CLOCK_REALTIME          0       /* Time of day */
+#define CLOCK_MONOTONIC         1       /* Time since boot */
+#define CLOCK_REALTIME_COARSE   2
+#define CLOCK_MONOTONIC_COARSE  3
+
 
 /*
  * Bits for interval timers. Obscure and not really that important.
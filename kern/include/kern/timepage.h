@@ -0,0 +1,33 @@
+#ifndef _KERN_TIMEPAGE_H_
+#define _KERN_TIMEPAGE_H_
+
+/*
+ * The time page.
+ *
+ * The kernel keeps the time in one page and maps it read-only at
+ * TIMEPAGE_VADDR in every process, so reading the clock doesn't take
+ * a system call. It is updated on every timer tick, so it is only as
+ * fine as that; clock_gettime's _COARSE clocks come from here.
+ *
+ * The kernel makes tp_seq odd before it changes anything and even
+ * again after. To read the page: wait for tp_seq to be even, read the
+ * rest, and start over if tp_seq has changed since.
+ *
+ * (This relies on the CPUs seeing each other's stores in order, which
+ * is true on System/161.)
+ *
+ * TIMEPAGE_VADDR is the page just below where the stack can grow to.
+ */
+
+#define TIMEPAGE_VADDR 0x7feff000
+
+struct timepage {
+	volatile __u32 tp_seq;		/* odd while being updated */
+	volatile __u32 tp_ticks;	/* timer ticks since boot */
+	volatile __time_t tp_sec;	/* time of day at the last tick */
+	volatile __i32 tp_nsec;
+	volatile __time_t tp_bootsec;	/* time of day at boot */
+	volatile __i32 tp_bootnsec;
+};
+
+#endif /* _KERN_TIMEPAGE_H_ */
@@ -55,6 +55,13 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * Slow this cpu's hardclock right down while it idles (IDLE true), or
+ * put it back to HZ. Idle cpus wake for interrupts anyway; the ticks
+ * would only wake them to find nothing to do. (OPT_A2 only.)
+ */
+void mainbus_idleclock(bool idle);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
@@ -0,0 +1,64 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Per-address-space page table.
+ *
+ * Two levels: a directory indexed by the top 10 bits of the virtual
+ * address, pointing to page-sized tables of PTEs indexed by the next
+ * 10 bits. Second-level tables are only allocated for the parts of
+ * the address space that have actually been touched, so a typical
+ * process (text and data near the bottom, stack near the top) needs
+ * two or three of them.
+ */
+
+#include <vm.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+
+typedef uint32_t pte_t;
+
+#define PT_ENTRIES	1024				/* PTEs per second-level table */
+#define PT_DIRENTRIES	(USERSPACETOP >> 22)		/* directory slots for kuseg */
+#define PT_DIRINDEX(va)	((va) >> 22)
+#define PT_INDEX(va)	(((va) >> 12) & (PT_ENTRIES - 1))
+
+/* PTE fields */
+#define PTE_FRAME	0xfffff000	/* physical frame of a resident page */
+#define PTE_VALID	0x00000001	/* page is resident in PTE_FRAME */
+#define PTE_WRITE	0x00000002	/* may be written; clear while shared copy-on-write */
+#define PTE_SWAPPED	0x00000004	/* page is on disk, in the swap slot in PTE_FRAME */
+
+/* A swapped-out page keeps its swap slot where a resident page keeps its frame */
+#define PTE_SLOT(pte)		((pte) >> 12)
+#define PTE_MKSWAPPED(slot)	(((pte_t)(slot) << 12) | PTE_SWAPPED)
+
+struct pagetable {
+	pte_t *pt_dir[PT_DIRENTRIES];
+};
+
+/* Create an empty page table. Returns NULL if out of memory. */
+struct pagetable *pt_create(void);
+
+/* Free the page table along with every frame and swap slot it maps. */
+void pt_destroy(struct pagetable *pt);
+
+/*
+ * Find the PTE for VADDR. If its second-level table doesn't exist yet,
+ * allocate it if CREATE is set and return NULL otherwise. Also returns
+ * NULL if allocating the table fails.
+ */
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+
+/*
+ * Map every page of OLD into NEWPT as well, copy-on-write: both sides
+ * lose PTE_WRITE and the frame's reference count goes up. Pages that
+ * are swapped out are copied to a new swap slot instead. The caller
+ * must flush any writable TLB entries for OLD.
+ */
+int pt_copy(struct pagetable *old, struct pagetable *newpt);
+
+#endif /* OPT_A3 */
+
+#endif /* _PAGETABLE_H_ */
@@ -0,0 +1,33 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+/*
+ * Anonymous pipes.
+ *
+ * A pipe is a page-sized ring buffer with two vnodes, one for each
+ * end, so the ends can sit in a file table and be closed, inherited
+ * and dup'd like any other file. Reading from the read end takes
+ * whatever is in the buffer (waiting if there is nothing, or returning
+ * 0 once the write end is closed); writing to the write end waits for
+ * room until everything is written, or fails with EPIPE once the read
+ * end is closed.
+ */
+
+struct vnode;
+struct uio;
+
+/* Create a pipe; returns a reference to each end. */
+int pipe_create(struct vnode **readend, struct vnode **writeend);
+
+/* True if V is one end of a pipe. */
+bool pipe_isend(struct vnode *v);
+
+/*
+ * The read and write operations. These are what VOP_READ and VOP_WRITE
+ * do on a pipe end, but can also be called directly to skip the VFS
+ * layer's locking.
+ */
+int pipe_read(struct vnode *v, struct uio *uio);
+int pipe_write(struct vnode *v, struct uio *uio);
+
+#endif /* _PIPE_H_ */
@@ -44,6 +44,9 @@
 
 struct addrspace;
 struct vnode;
+#ifdef OPT_A2
+struct filetable;
+#endif // OPT_A2
 #ifdef UW
 struct semaphore;
 #endif // UW
@@ -79,7 +82,10 @@ struct proc {
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 
-#ifdef UW
+#ifdef OPT_A2
+	/* open files, by descriptor; NULL once the process has exited */
+	struct filetable *p_filetable;
+#elif defined(UW)
 
   /* a vnode to refer to the console device */
   /* this is a quick-and-dirty way to get console writes working */
@@ -95,24 +101,25 @@ struct proc {
 #ifdef OPT_A2
 
 	/* Keep track of the parent, so that when we exit, we can decide either to be a zombie (so our parent can read our exit code) or 
-	 * just exit and kill ourselves if our parent is already dead */
+	 * just exit and kill ourselves if our parent is already dead. Protected by proc_waitlock. */
   	struct proc *parent;  
 
-	/* Keep track of our children, for waitpid (since a thread can only call waitpid on its children) */
+	/* Keep track of our children, for waitpid (since a thread can only call waitpid on its children).
+	 * Only our own thread touches this */
 	struct childarray *p_children;
 	pid_t p_pid;
 
-
-	/* These will be used for sleeping on our child when we call waitpid, waiting for 
-	 * the child to become a zombie */
+	/* We sleep on this in waitpid, with proc_waitlock, until one of our children becomes a zombie */
 	struct cv *p_zombie_cv;
-	struct lock *p_zombie_mutex;
 
-	int exitstatus;
+	int exitstatus;		/* as waitpid returns it, e.g. _MKWAIT_EXIT(code) */
 
-	/* For now we'll say a zombie is a process where the threadarray and address space are claned up*/
+	/* A zombie has exited and is only waiting for its parent to collect exitstatus. Protected by proc_waitlock */
 	bool zombie; 
 
+	/* Set if our address space is borrowed from our parent by vfork; V'd when we give it back */
+	struct semaphore *p_vforkdone;
+
 #endif /* OPT_A2 */
 };
 
@@ -124,6 +131,11 @@ extern struct proc *kproc;
 extern struct semaphore *no_proc_sem;
 #endif // UW
 
+#ifdef OPT_A2
+/* Lock for exiting and waiting: every process's parent, zombie and exitstatus */
+extern struct lock *proc_waitlock;
+#endif // OPT_A2
+
 /* Call once during system startup to allocate data structures. */
 void proc_bootstrap(void);
 
@@ -147,6 +159,12 @@ struct addrspace *curproc_setas(struct addrspace *);
 
 #ifdef OPT_A2
 
+/* Give a process the next free PID. Returns ENPROC if there are none left. */
+int proc_assignpid(struct proc *proc);
+
+/* Give a process's PID back. proc_destroy does this. */
+void proc_releasepid(struct proc *proc);
+
 /* Remove child from the childarray of parent */
 void proc_removechild(struct proc *parent, struct proc *child);
 
@@ -154,10 +172,13 @@ void proc_removechild(struct proc *parent, struct proc *child);
  * Made for use inside sys_fork */
 int proc_addchild(struct proc *parent, struct proc *child);
 
-/* Fetch the child process whose pid matches childid. If none exist, return NULL */
+/* Fetch the child process whose pid matches childid, by PID table lookup. If none exist, return NULL */
 struct proc *proc_getchild(struct proc *proc, pid_t childid);
 
-/* Delete zombie children. To be used in sys__exit() (when becoming a zombie) */
+/* Find a child of proc that is a zombie, or return NULL. Call with proc_waitlock held */
+struct proc *proc_findzombie(struct proc *proc);
+
+/* Delete zombie children and orphan the rest. To be used in proc_exit(), with proc_waitlock held */
 void proc_destroy_zombie_children(struct proc *proc);
 
 #endif //OPT_A2
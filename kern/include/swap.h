@@ -0,0 +1,40 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space.
+ *
+ * Evicted user pages are written to a raw disk (lhd1raw:), one page
+ * per slot; a bitmap records which slots are in use. A page table
+ * entry for a page that lives in swap holds its slot number instead of
+ * a frame (see pagetable.h).
+ *
+ * If there is no swap disk the kernel still runs, it just can't evict
+ * anything, so running out of memory fails the same way it used to.
+ */
+
+#include "opt-A3.h"
+
+#if OPT_A3
+
+/* Open the swap disk. Called from vm_bootstrap. */
+void swap_bootstrap(void);
+
+/* True if there is a swap disk to page out to. */
+bool swap_available(void);
+
+/* Write the frame at PADDR to a free slot and return the slot in *SLOT. */
+int swap_out(paddr_t paddr, unsigned *slot);
+
+/* Read SLOT into the frame at PADDR and release the slot. */
+int swap_in(unsigned slot, paddr_t paddr);
+
+/* Copy SLOT into a new slot, returned in *NEWSLOT (for fork). */
+int swap_dup(unsigned slot, unsigned *newslot);
+
+/* Release SLOT without reading it. */
+void swap_free(unsigned slot);
+
+#endif /* OPT_A3 */
+
+#endif /* _SWAP_H_ */
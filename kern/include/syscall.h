@@ -32,6 +32,7 @@
 
 #include <synch.h> // for lock, for the PID assignment counter.
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 
 struct trapframe; /* from <machine/trapframe.h> */
@@ -63,33 +64,42 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
-
 #ifdef OPT_A2
+int sys___clock_gettime(int clockid, userptr_t user_timespec);
+int sys_nanosleep(userptr_t user_req, userptr_t user_rem);
+#endif /* OPT_A2 */
 
-/*
- *
- * Q : For the purposes of OS161, a global PID counter will suffice for assigning
- * PID's to new processes.
- *
- * However how do we make sure the assignment is threadsafe? Use locks. But exactly how will
- *  the OS use these locks? Eg. Where will they be initialized, acquired and released? What function?
- * 
- *
- * Initializing seems to be the problem I have trouble to figure out.
- * answer: initialize in proc_bootstrap() in proc.h
- *
- */
-volatile pid_t pid_counter;
-
-//for providing mutual exclusion when updating the counter
-
-struct spinlock pid_counter_mutex;
+#ifdef OPT_A2
 
 int sys_fork(struct trapframe *tf, pid_t *retval);
+int sys_vfork(struct trapframe *tf, pid_t *retval);
+int sys_spawn(userptr_t program, userptr_t args, pid_t *retval);
+
+/* The guts of sys__exit; also used to kill a process that took a fatal fault */
+void proc_exit(int exitstatus);
 int sys_execv(userptr_t program, userptr_t args);
 
-/* Get the number of arguments from args and write it in argc, where args has type (char **). For use with execv */
-int sys_execv_count_args(userptr_t args, int *argc);
+/* Copy args, which has type (char **), into a new argbuf packed for as_define_stack_args, and write the number of arguments in argc. For use with execv; the caller kfrees argbuf */
+int sys_execv_copyin_args(userptr_t args, char **argbuf, int *argc, size_t *arglen);
+
+/* File calls, in file_syscalls.c (sys_write is declared below) */
+int sys_open(userptr_t path, int flags, mode_t mode, int *retval);
+int sys_read(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval);
+int sys_lseek(int fdesc, off_t pos, int whence, off_t *retval);
+int sys_pread(int fdesc, userptr_t ubuf, size_t nbytes, off_t pos, int *retval);
+int sys_pwrite(int fdesc, userptr_t ubuf, size_t nbytes, off_t pos, int *retval);
+int sys_readv(int fdesc, userptr_t uiov, int iovcnt, int *retval);
+int sys_writev(int fdesc, userptr_t uiov, int iovcnt, int *retval);
+int sys_close(int fdesc);
+int sys_dup2(int oldfd, int newfd, int *retval);
+int sys_pipe(userptr_t fds, int *retval);
+
+/* Batched reads, writes and seeks (see <kern/ioring.h>), in ioring_syscalls.c */
+int sys_ioring_enter(userptr_t uring, int *retval);
+
+/* Per-cpu call counts and latencies, for every system call (see syscall.c) */
+struct syscall_stats *syscall_stats_create(void);
+void syscall_printstats(void);
 #endif /* OPT_A2 */
 
 #ifdef UW
@@ -100,4 +110,8 @@ int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
 
 #endif // UW
 
+#if OPT_A3
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+#endif /* OPT_A3 */
+
 #endif /* _SYSCALL_H_ */
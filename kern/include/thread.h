@@ -39,6 +39,7 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include "opt-A2.h"
 
 struct cpu;
 
@@ -49,6 +50,11 @@ struct cpu;
 /* Size of kernel stacks; must be power of 2 */
 #define STACK_SIZE 4096
 
+#ifdef OPT_A2
+/* Names shorter than this are kept in the thread itself, not kmalloc'd */
+#define THREAD_NAMEBUF 32
+#endif
+
 /* Mask for extracting the stack base address of a kernel stack pointer */
 #define STACK_MASK  (~(vaddr_t)(STACK_SIZE-1))
 
@@ -73,6 +79,9 @@ struct thread {
 	char *t_name;			/* Name of this thread */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
+#ifdef OPT_A2
+	char t_namebuf[THREAD_NAMEBUF];	/* t_name, if it fits */
+#endif
 
 	/*
 	 * Thread subsystem internal fields.
@@ -101,6 +110,19 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+#ifdef OPT_A2
+	/*
+	 * Scheduler fields; see schedule() in thread.c. Only touched
+	 * by the cpu the thread is on, with its runqueue lock held or
+	 * while the thread is running.
+	 */
+	unsigned t_level;		/* Priority level; 0 is highest */
+	unsigned t_ticks;		/* Hardclocks used of this level's quantum */
+
+	struct wchan *t_wchan;		/* Wait channel it is on, if any;
+					   protected by that channel's lock */
+#endif
+
 	/*
 	 * Public fields
 	 */
@@ -162,6 +184,27 @@ void thread_yield(void);
  */
 void schedule(void);
 
+#ifdef OPT_A2
+/*
+ * Charge the current thread for a hardclock, and switch away from it
+ * if its quantum is used up or something more important is ready.
+ * Called from the timer interrupt.
+ */
+void thread_tick(void);
+
+/*
+ * Set the level-0 scheduling quantum, in hardclocks, of cpu CPUNUM,
+ * or of every cpu if CPUNUM is -1. Lower levels get multiples of it.
+ */
+int thread_setquantum(int cpunum, unsigned hardclocks);
+
+/* Print every cpu's quantum. */
+void thread_printquanta(void);
+
+/* Print how well each cpu's cache of exited threads is doing. */
+void thread_printcachestats(void);
+#endif
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
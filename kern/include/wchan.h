@@ -71,6 +71,13 @@ void wchan_unlock(struct wchan *wc);
  */
 void wchan_sleep(struct wchan *wc);
 
+/*
+ * Like wchan_sleep, but if nobody has woken the thread after USEC
+ * microseconds, it wakes by itself. Returns 0 if it was woken and
+ * ETIMEDOUT if not. (OPT_A2 only.)
+ */
+int wchan_sleep_timeout(struct wchan *wc, unsigned usec);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The queue should not already be locked.
@@ -0,0 +1,202 @@
+/*
+ * Open files and file descriptor tables. See filetable.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <filetable.h>
+#include "opt-A2.h"
+
+#ifdef OPT_A2
+
+int
+openfile_open(char *path, int flags, mode_t mode, struct openfile **ret)
+{
+	struct vnode *v;
+	int result;
+
+	result = vfs_open(path, flags, mode, &v);
+	if (result) {
+		return result;
+	}
+
+	result = openfile_create(v, flags, ret);
+	if (result) {
+		vfs_close(v);
+		return result;
+	}
+	return 0;
+}
+
+int
+openfile_create(struct vnode *v, int flags, struct openfile **ret)
+{
+	struct openfile *of;
+
+	of = kmalloc(sizeof(struct openfile));
+	if (of == NULL) {
+		return ENOMEM;
+	}
+	of->of_lock = lock_create("openfile");
+	if (of->of_lock == NULL) {
+		kfree(of);
+		return ENOMEM;
+	}
+
+	of->of_vnode = v;
+	of->of_accmode = flags & O_ACCMODE;
+	of->of_append = (flags & O_APPEND) != 0;
+	of->of_offset = 0;
+	spinlock_init(&of->of_reflock);
+	of->of_refcount = 1;
+
+	*ret = of;
+	return 0;
+}
+
+void
+openfile_incref(struct openfile *of)
+{
+	spinlock_acquire(&of->of_reflock);
+	KASSERT(of->of_refcount > 0);
+	of->of_refcount++;
+	spinlock_release(&of->of_reflock);
+}
+
+void
+openfile_decref(struct openfile *of)
+{
+	bool last;
+
+	spinlock_acquire(&of->of_reflock);
+	KASSERT(of->of_refcount > 0);
+	of->of_refcount--;
+	last = (of->of_refcount == 0);
+	spinlock_release(&of->of_reflock);
+
+	if (!last) {
+		return;
+	}
+
+	vfs_close(of->of_vnode);
+	lock_destroy(of->of_lock);
+	spinlock_cleanup(&of->of_reflock);
+	kfree(of);
+}
+
+struct filetable *
+filetable_create(void)
+{
+	struct filetable *ft;
+	int fd;
+
+	ft = kmalloc(sizeof(struct filetable));
+	if (ft == NULL) {
+		return NULL;
+	}
+	for (fd = 0; fd < OPEN_MAX; fd++) {
+		ft->ft_files[fd] = NULL;
+	}
+	return ft;
+}
+
+void
+filetable_destroy(struct filetable *ft)
+{
+	int fd;
+
+	KASSERT(ft != NULL);
+
+	for (fd = 0; fd < OPEN_MAX; fd++) {
+		if (ft->ft_files[fd] != NULL) {
+			openfile_decref(ft->ft_files[fd]);
+		}
+	}
+	kfree(ft);
+}
+
+int
+filetable_copy(struct filetable *ft, struct filetable **ret)
+{
+	struct filetable *newft;
+	int fd;
+
+	newft = filetable_create();
+	if (newft == NULL) {
+		return ENOMEM;
+	}
+
+	for (fd = 0; fd < OPEN_MAX; fd++) {
+		if (ft->ft_files[fd] != NULL) {
+			openfile_incref(ft->ft_files[fd]);
+			newft->ft_files[fd] = ft->ft_files[fd];
+		}
+	}
+
+	*ret = newft;
+	return 0;
+}
+
+int
+filetable_openstd(struct filetable *ft)
+{
+	static const int stdflags[3] = { O_RDONLY, O_WRONLY, O_WRONLY };
+	struct openfile *of;
+	char path[5];
+	int fd, result;
+
+	for (fd = 0; fd < 3; fd++) {
+		KASSERT(ft->ft_files[fd] == NULL);
+
+		/* vfs_open can scribble on the path */
+		strcpy(path, "con:");
+		result = openfile_open(path, stdflags[fd], 0, &of);
+		if (result) {
+			return result;
+		}
+		ft->ft_files[fd] = of;
+	}
+	return 0;
+}
+
+int
+filetable_get(struct filetable *ft, int fd, struct openfile **ret)
+{
+	if (fd < 0 || fd >= OPEN_MAX || ft->ft_files[fd] == NULL) {
+		return EBADF;
+	}
+	*ret = ft->ft_files[fd];
+	return 0;
+}
+
+int
+filetable_place(struct filetable *ft, struct openfile *of, int *fd)
+{
+	int i;
+
+	for (i = 0; i < OPEN_MAX; i++) {
+		if (ft->ft_files[i] == NULL) {
+			ft->ft_files[i] = of;
+			*fd = i;
+			return 0;
+		}
+	}
+	return EMFILE;
+}
+
+void
+filetable_set(struct filetable *ft, int fd, struct openfile *of,
+	      struct openfile **oldof)
+{
+	KASSERT(fd >= 0 && fd < OPEN_MAX);
+
+	*oldof = ft->ft_files[fd];
+	ft->ft_files[fd] = of;
+}
+
+#endif /* OPT_A2 */
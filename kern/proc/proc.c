@@ -48,7 +48,11 @@
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
+#include <kern/errno.h>
 #include <kern/fcntl.h>  
+#include <limits.h>
+#include <bitmap.h>
+#include <filetable.h>
 #include <syscall.h>
 #include "opt-A2.h"
 
@@ -60,8 +64,46 @@
 #include <proc.h>
 
 #ifdef OPT_A2
-extern volatile pid_t pid_counter;
-extern struct spinlock *pid_counter_mutex_p;
+/*
+ * PID table.
+ *
+ * pid_map has a bit set for every PID in use, and pid_procs maps it
+ * back to its process, so looking a process up by PID is just an
+ * array index. A PID stays in use until its process is destroyed, so
+ * a zombie keeps its PID until it is reaped.
+ *
+ * New PIDs are handed out going up from the last one, wrapping at
+ * PID_TABLESIZE, so a PID that was just freed isn't reused right away.
+ *
+ * The table only covers the first PID_TABLESIZE PIDs rather than all
+ * of PID_MAX, which would cost 128K of pointers; that is still far
+ * more processes than fit in memory at once.
+ */
+#define PID_TABLESIZE 1024
+#if PID_TABLESIZE > PID_MAX + 1
+#error "PID_TABLESIZE must not go past PID_MAX"
+#endif
+
+static struct spinlock pid_lock = SPINLOCK_INITIALIZER;
+static struct bitmap *pid_map;
+static struct proc *pid_procs[PID_TABLESIZE];
+static pid_t pid_next;
+
+/*
+ * Exit and wait.
+ *
+ * A child that exits while its parent is alive becomes a zombie and
+ * wakes the parent, which sleeps on its own p_zombie_cv, so one cv
+ * serves waiting for a particular child and for any child. The parent
+ * destroys the zombie as soon as it has collected the exit status.
+ * When the parent exits first, it destroys its zombie children and
+ * orphans the rest, which then destroy themselves when they exit.
+ *
+ * A child can't take its parent's lock safely, since the parent may
+ * be exiting and freed at the same moment, so the parent links and
+ * the zombie state are all under the one proc_waitlock.
+ */
+struct lock *proc_waitlock;
 #endif // OPT_A2
 
 /*
@@ -110,9 +152,11 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
-#ifdef UW
+#ifdef OPT_A2
+	proc->p_filetable = NULL;
+#elif defined(UW)
 	proc->console = NULL;
-#endif // UW
+#endif // OPT_A2
 
 #ifdef OPT_A2
 	proc->parent = NULL;
@@ -121,9 +165,10 @@ proc_create(const char *name)
 
 	proc->p_pid = 0;
 
-	proc->p_zombie_mutex = lock_create(name);
 	proc->p_zombie_cv = cv_create(name);
+	proc->exitstatus = 0;
 	proc->zombie = false;
+	proc->p_vforkdone = NULL;
 
 #endif //OPT_A2
 
@@ -181,33 +226,29 @@ proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
-#ifdef UW
+#ifdef OPT_A2
+	/* Normally already closed in proc_exit */
+	if (proc->p_filetable) {
+		filetable_destroy(proc->p_filetable);
+		proc->p_filetable = NULL;
+	}
+#elif defined(UW)
 	if (proc->console) {
 	  vfs_close(proc->console);
 	}
-#endif // UW
+#endif // OPT_A2
 
 #ifdef OPT_A2
 
-	/* Before we destroy the array, we require it to be empty first */
-	int childarray_size = childarray_num(proc->p_children);
-
-	while(childarray_size > 0)
-	{
-		int index = childarray_size - 1;
-
-		/* Set the child's parent pointer to NULL, so it knows to fully delete itself when sys__exit is called*/
-		struct proc *child = childarray_get(proc->p_children, index);
-		child->parent = NULL;
-
-		childarray_remove(proc->p_children, index);
-
-		childarray_size = childarray_num(proc->p_children);
+	if (proc->p_pid != 0) {
+		proc_releasepid(proc);
 	}
 
+	/* Children were already dealt with in proc_exit, or there never were any */
+	KASSERT(childarray_num(proc->p_children) == 0);
+
 	childarray_destroy(proc->p_children);
 	cv_destroy(proc->p_zombie_cv);
-	lock_destroy(proc->p_zombie_mutex);
 
 #endif //OPT_A2
 
@@ -258,24 +299,72 @@ proc_bootstrap(void)
 #endif // UW 
 
 #ifdef OPT_A2
+  pid_map = bitmap_create(PID_TABLESIZE);
+  if (pid_map == NULL) {
+    panic("could not create the PID table\n");
+  }
+  /* PIDs below PID_MIN are never handed out */
+  for (pid_t pid = 0; pid < PID_MIN; pid++) {
+    bitmap_mark(pid_map, pid);
+  }
+  pid_next = PID_MIN;
 
- // Initialize the counter for PID assignment here.
+  proc_waitlock = lock_create("proc_waitlock");
+  if (proc_waitlock == NULL) {
+    panic("could not create proc_waitlock\n");
+  }
+#endif // OPT_A2
 
- // Question: where do we call spinlock_cleanup()? 
- // Do we need to care about freeing it if it is supposed to stay
- // alive as long as the OS does?
+}
 
- pid_counter = 0; 
+#ifdef OPT_A2
 
- spinlock_init(&pid_counter_mutex); //just assume it will always work
+int proc_assignpid(struct proc *proc)
+{
+	pid_t pid;
+	int i;
 
- pid_counter += 0; //silence the warning of unused variable.
+	KASSERT(proc->p_pid == 0);
 
-#endif // OPT_A2
+	spinlock_acquire(&pid_lock);
+
+	/* Next fit from where the last search left off */
+	pid = pid_next;
+	for (i = PID_MIN; i < PID_TABLESIZE; i++) {
+		if (!bitmap_isset(pid_map, pid)) {
+			break;
+		}
+		pid = (pid == PID_TABLESIZE - 1) ? PID_MIN : pid + 1;
+	}
+	if (i == PID_TABLESIZE) {
+		spinlock_release(&pid_lock);
+		return ENPROC;
+	}
+
+	bitmap_mark(pid_map, pid);
+	pid_procs[pid] = proc;
+	proc->p_pid = pid;
+	pid_next = (pid == PID_TABLESIZE - 1) ? PID_MIN : pid + 1;
 
+	spinlock_release(&pid_lock);
+
+	return 0;
 }
 
-#ifdef OPT_A2
+void proc_releasepid(struct proc *proc)
+{
+	pid_t pid = proc->p_pid;
+
+	KASSERT(pid >= PID_MIN && pid < PID_TABLESIZE);
+
+	spinlock_acquire(&pid_lock);
+	KASSERT(pid_procs[pid] == proc);
+	pid_procs[pid] = NULL;
+	bitmap_unmark(pid_map, pid);
+	spinlock_release(&pid_lock);
+
+	proc->p_pid = 0;
+}
 
 int proc_addchild(struct proc *parent, struct proc *child)
 {
@@ -300,20 +389,12 @@ void proc_removechild(struct proc *parent, struct proc *child)
 	struct childarray *children = parent->p_children;
 	int num_children = childarray_num(parent->p_children);
 
-	int child_pid = child->p_pid;
-
 	for(int i = 0; i < num_children; ++i)
 	{
-		struct proc *current = childarray_get(parent->p_children, i);
-		spinlock_acquire(&current->p_lock);
-
-		if(current->p_pid == child_pid) {
+		if(childarray_get(children, i) == child) {
 			childarray_remove(children, i);
-			spinlock_release(&current->p_lock);
 			break;
 		}
-
-		spinlock_release(&current->p_lock);
 	}
 	spinlock_release(&parent->p_lock);
 
@@ -321,56 +402,74 @@ void proc_removechild(struct proc *parent, struct proc *child)
 
 struct proc *proc_getchild(struct proc *proc, pid_t childid)
 {	
+	struct proc *child;
+
 	DEBUG(DB_SYSCALL, "proc_getchild | proc:%s\n", proc->p_name);
 
-	spinlock_acquire(&proc->p_lock);
+	if (childid < PID_MIN || childid >= PID_TABLESIZE) {
+		return NULL;
+	}
+
+	/* 
+	 * Check the parent while still holding pid_lock: a process
+	 * gives up its PID before it is freed, so it can't go away
+	 * under us.
+	 */
+	spinlock_acquire(&pid_lock);
+	child = pid_procs[childid];
+	if (child != NULL && child->parent != proc) {
+		child = NULL;
+	}
+	spinlock_release(&pid_lock);
+
+	if (child != NULL) {
+		DEBUG(DB_SYSCALL,"proc_getchild | proc:%s acquired child %s pid:%d\n", proc->p_name, child->p_name, child->p_pid);
+	}
+	return child;
+}
+
+struct proc *proc_findzombie(struct proc *proc)
+{
+	KASSERT(lock_do_i_hold(proc_waitlock));
+
+	int num_children = childarray_num(proc->p_children);
 
-	int num_children = childarray_num(proc->p_children); 
 	for(int i = 0; i < num_children; ++i)
 	{
 		struct proc *current = childarray_get(proc->p_children, i);
-		if(current->p_pid == childid) {	
-			
-			DEBUG(DB_SYSCALL,"proc_getchild | proc:%s acquired child %s pid:%d\n", proc->p_name, current->p_name, current->p_pid);
-			spinlock_release(&proc->p_lock);
+
+		if(current->zombie) {
 			return current;
 		}
 	}
-	spinlock_release(&proc->p_lock);
 	return NULL;
 }
 
 void proc_destroy_zombie_children(struct proc *proc)
 {	
 	KASSERT(proc != NULL);
+	KASSERT(lock_do_i_hold(proc_waitlock));
 	DEBUG(DB_SYSCALL,"proc_destroy_zombie_children | proc:%s\n", proc->p_name);
 
-	int num_children = childarray_num(proc->p_children);
-
-	for(int i = 0; i < num_children;)
+	/* From the end, so removing doesn't shift what is left to look at */
+	for(int i = childarray_num(proc->p_children) - 1; i >= 0; --i)
 	{
 		struct proc *current = childarray_get(proc->p_children, i);
 
-		spinlock_acquire(&current->p_lock);
+		childarray_remove(proc->p_children, i);
 
 		if(current->zombie) {
 
-			DEBUG(DB_SYSCALL, "proc_destroy_zombie_children | proc:%s\n deleting child:%s\n", proc->p_name, current->p_name);
+			DEBUG(DB_SYSCALL, "proc_destroy_zombie_children | proc:%s deleting child:%s\n", proc->p_name, current->p_name);
 
-			childarray_remove(proc->p_children, i);	
-			spinlock_release(&current->p_lock);
+			/* Nobody is going to wait for it now */
 			proc_destroy(current);
 
-			--num_children;
-			//don't increase the index, all the other elements in the array past this one will be shifted downwards
-			//
 		} else {
 
 			/* Set our child's parent pointer to NULL, so they know to
-			 * fully delete themselves in sys__exit() */
+			 * fully delete themselves in proc_exit() */
 			current->parent = NULL;
-			spinlock_release(&current->p_lock);
-			++i;
 		}
 	}
 
@@ -395,7 +494,10 @@ proc_create_runprogram(const char *name)
 		return NULL;
 	}
 
-#ifdef UW
+#ifdef OPT_A2
+	/* descriptors are set up below, once proc_destroy can clean up */
+	(void)console_path;
+#elif defined(UW)
 	/* open the console - this should always succeed */
 	console_path = kstrdup("con:");
 	if (console_path == NULL) {
@@ -439,6 +541,31 @@ proc_create_runprogram(const char *name)
 	V(proc_count_mutex);
 #endif // UW
 
+#ifdef OPT_A2
+	if (proc_assignpid(proc)) {
+		proc_destroy(proc);
+		return NULL;
+	}
+
+	/*
+	 * A forked child inherits its parent's descriptors, the same way
+	 * it inherits the cwd above; a program started from the menu gets
+	 * the console on 0, 1 and 2, which should always open.
+	 */
+	if (curproc->p_filetable != NULL) {
+		if (filetable_copy(curproc->p_filetable, &proc->p_filetable)) {
+			proc_destroy(proc);
+			return NULL;
+		}
+	} else {
+		proc->p_filetable = filetable_create();
+		if (proc->p_filetable == NULL ||
+		    filetable_openstd(proc->p_filetable)) {
+			panic("unable to open the console during process creation\n");
+		}
+	}
+#endif // OPT_A2
+
 	return proc;
 }
 
@@ -50,6 +50,12 @@
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
+#include "opt-A2.h"
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <uw-vmstats.h>
+#endif /* OPT_A3 */
 
 
 /*
@@ -117,6 +123,10 @@ boot(void)
 	KASSERT(curthread->t_curspl > 0);
 	mainbus_bootstrap();
 	KASSERT(curthread->t_curspl == 0);
+#ifdef OPT_A2
+	/* The time page needs the clock device */
+	timepage_bootstrap();
+#endif /* OPT_A2 */
 	/* Now do pseudo-devices. */
 	pseudoconfig();
 	kprintf("\n");
@@ -153,6 +163,10 @@ shutdown(void)
 
 	thread_shutdown();
 
+#if OPT_A3
+	vmstats_print();
+#endif /* OPT_A3 */
+
 	splhigh();
 }
 
@@ -45,6 +45,7 @@
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-A2.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -400,6 +401,62 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+#ifdef OPT_A2
+static
+int
+cmd_syscallstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	syscall_printstats();
+
+	return 0;
+}
+
+/*
+ * Command to show or set the scheduling quantum, of every cpu or just
+ * one. As with any command, it can be given at boot in the kernel
+ * arguments.
+ */
+static
+int
+cmd_quantum(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 1) {
+		thread_printquanta();
+		return 0;
+	}
+	if (nargs > 3) {
+		kprintf("Usage: sq [hardclocks [cpu]]\n");
+		return EINVAL;
+	}
+
+	result = thread_setquantum(nargs == 3 ? atoi(args[2]) : -1,
+				   atoi(args[1]));
+	if (result) {
+		kprintf("sq: %s\n", strerror(result));
+		return result;
+	}
+	thread_printquanta();
+	return 0;
+}
+
+static
+int
+cmd_threadcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printcachestats();
+
+	return 0;
+}
+#endif // OPT_A2
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -509,6 +566,11 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+#ifdef OPT_A2
+	"[ks] System call stats              ",
+	"[sq] Scheduling quantum             ",
+	"[tc] Thread cache stats             ",
+#endif // OPT_A2
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -589,6 +651,11 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+#ifdef OPT_A2
+	{ "ks",         cmd_syscallstats },
+	{ "sq",         cmd_quantum },
+	{ "tc",         cmd_threadcachestats },
+#endif // OPT_A2
 
 	/* base system tests */
 	{ "at",		arraytest },
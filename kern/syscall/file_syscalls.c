@@ -8,6 +8,474 @@
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include "opt-A2.h"
+
+#ifdef OPT_A2
+#include <kern/fcntl.h>
+#include <kern/seek.h>
+#include <kern/stat.h>
+#include <limits.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <filetable.h>
+#include <pipe.h>
+
+/*
+ * File system calls, over the descriptor table in struct proc (see
+ * filetable.h).
+ *
+ * Reads and writes hold the openfile's lock across the VOP call, so
+ * the offset update is atomic with respect to anyone else sharing
+ * the openfile. Devices like the console ignore the offset.
+ *
+ * Pipes have no offset and take turns among their own readers and
+ * writers, so they are called directly, without the openfile lock or
+ * the VFS layer's.
+ */
+
+int
+sys_open(userptr_t upath, int flags, mode_t mode, int *retval)
+{
+  char *path;
+  struct openfile *of;
+  int result;
+
+  path = kmalloc(PATH_MAX);
+  if (path == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr((const_userptr_t)upath, path, PATH_MAX, NULL);
+  if (result) {
+    kfree(path);
+    return result;
+  }
+
+  DEBUG(DB_SYSCALL,"Syscall: open(%s,%x,%o)\n",path,flags,mode);
+
+  result = openfile_open(path, flags, mode, &of);
+  kfree(path);
+  if (result) {
+    return result;
+  }
+
+  result = filetable_place(curproc->p_filetable, of, retval);
+  if (result) {
+    openfile_decref(of);
+    return result;
+  }
+  return 0;
+}
+
+/* Set up U to move NBYTES to or from the user buffer UBUF through IOV. */
+static
+void
+file_uinit(struct iovec *iov, struct uio *u, userptr_t ubuf, size_t nbytes,
+           enum uio_rw rw)
+{
+  iov->iov_ubase = ubuf;
+  iov->iov_len = nbytes;
+  u->uio_iov = iov;
+  u->uio_iovcnt = 1;
+  u->uio_offset = 0;
+  u->uio_resid = nbytes;
+  u->uio_segflg = UIO_USERSPACE;
+  u->uio_rw = rw;
+  u->uio_space = curproc->p_addrspace;
+}
+
+/*
+ * Copy in the user's array of IOVCNT iovecs at UIOV and set up U to
+ * move data through them. The array goes in IOVBUF if it fits (NBUF
+ * entries), and in *IOVS otherwise, which must then be kfree'd.
+ */
+static
+int
+file_uinitv(struct iovec *iovbuf, unsigned nbuf, struct iovec **iovs,
+            struct uio *u, userptr_t uiov, int iovcnt, enum uio_rw rw)
+{
+  struct iovec *iov;
+  size_t total;
+  int i, result;
+
+  *iovs = NULL;
+  if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+    return EINVAL;
+  }
+
+  if ((unsigned)iovcnt <= nbuf) {
+    iov = iovbuf;
+  } else {
+    iov = kmalloc(iovcnt * sizeof(struct iovec));
+    if (iov == NULL) {
+      return ENOMEM;
+    }
+    *iovs = iov;
+  }
+
+  result = copyin((const_userptr_t)uiov, iov, iovcnt * sizeof(struct iovec));
+  if (result) {
+    goto fail;
+  }
+
+  /* the count of bytes moved has to fit in the (int) return value */
+  total = 0;
+  for (i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len > 0x7fffffff - total) {
+      result = EINVAL;
+      goto fail;
+    }
+    total += iov[i].iov_len;
+  }
+
+  u->uio_iov = iov;
+  u->uio_iovcnt = iovcnt;
+  u->uio_offset = 0;
+  u->uio_resid = total;
+  u->uio_segflg = UIO_USERSPACE;
+  u->uio_rw = rw;
+  u->uio_space = curproc->p_addrspace;
+  return 0;
+
+ fail:
+  if (*iovs != NULL) {
+    kfree(*iovs);
+    *iovs = NULL;
+  }
+  return result;
+}
+
+/*
+ * Do the read or write set up in U on descriptor FDESC. If POSITIONAL,
+ * it is done at u->uio_offset and the descriptor's offset is left
+ * alone; otherwise it is done at, and moves on, the descriptor's
+ * offset.
+ */
+static
+int
+file_rw(int fdesc, struct uio *u, bool positional, int *retval)
+{
+  struct openfile *of;
+  struct stat st;
+  size_t nbytes = u->uio_resid;
+  int result;
+
+  result = filetable_get(curproc->p_filetable, fdesc, &of);
+  if (result) {
+    return result;
+  }
+  if (of->of_accmode == (u->uio_rw == UIO_READ ? O_WRONLY : O_RDONLY)) {
+    return EBADF;
+  }
+
+  if (pipe_isend(of->of_vnode)) {
+    if (positional) {
+      return ESPIPE;
+    }
+    if (u->uio_rw == UIO_READ) {
+      result = pipe_read(of->of_vnode, u);
+    } else {
+      result = pipe_write(of->of_vnode, u);
+    }
+    if (result) {
+      return result;
+    }
+    *retval = nbytes - u->uio_resid;
+    return 0;
+  }
+
+  if (positional) {
+    if (u->uio_offset < 0) {
+      return EINVAL;
+    }
+    /* this fails with ESPIPE on the console, as for lseek */
+    result = VOP_TRYSEEK(of->of_vnode, u->uio_offset);
+    if (result) {
+      return result;
+    }
+    /* the file system does its own locking; ours only guards the offset */
+    if (u->uio_rw == UIO_READ) {
+      result = VOP_READ(of->of_vnode, u);
+    } else {
+      result = VOP_WRITE(of->of_vnode, u);
+    }
+    if (result) {
+      return result;
+    }
+    *retval = nbytes - u->uio_resid;
+    return 0;
+  }
+
+  lock_acquire(of->of_lock);
+
+  if (u->uio_rw == UIO_WRITE && of->of_append) {
+    result = VOP_STAT(of->of_vnode, &st);
+    if (result) {
+      lock_release(of->of_lock);
+      return result;
+    }
+    of->of_offset = st.st_size;
+  }
+  u->uio_offset = of->of_offset;
+
+  if (u->uio_rw == UIO_READ) {
+    result = VOP_READ(of->of_vnode, u);
+  } else {
+    result = VOP_WRITE(of->of_vnode, u);
+  }
+  if (result) {
+    lock_release(of->of_lock);
+    return result;
+  }
+
+  of->of_offset = u->uio_offset;
+  lock_release(of->of_lock);
+
+  /* pass back the number of bytes actually transferred */
+  *retval = nbytes - u->uio_resid;
+  KASSERT(*retval >= 0);
+  return 0;
+}
+
+int
+sys_read(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+{
+  struct iovec iov;
+  struct uio u;
+
+  DEBUG(DB_SYSCALL,"Syscall: read(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+  file_uinit(&iov, &u, ubuf, nbytes, UIO_READ);
+  return file_rw(fdesc, &u, false, retval);
+}
+
+int
+sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+{
+  struct iovec iov;
+  struct uio u;
+
+  DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+  file_uinit(&iov, &u, ubuf, nbytes, UIO_WRITE);
+  return file_rw(fdesc, &u, false, retval);
+}
+
+int
+sys_pread(int fdesc, userptr_t ubuf, size_t nbytes, off_t pos, int *retval)
+{
+  struct iovec iov;
+  struct uio u;
+
+  DEBUG(DB_SYSCALL,"Syscall: pread(%d,%x,%d,%lld)\n",fdesc,(unsigned int)ubuf,nbytes,pos);
+  file_uinit(&iov, &u, ubuf, nbytes, UIO_READ);
+  u.uio_offset = pos;
+  return file_rw(fdesc, &u, true, retval);
+}
+
+int
+sys_pwrite(int fdesc, userptr_t ubuf, size_t nbytes, off_t pos, int *retval)
+{
+  struct iovec iov;
+  struct uio u;
+
+  DEBUG(DB_SYSCALL,"Syscall: pwrite(%d,%x,%d,%lld)\n",fdesc,(unsigned int)ubuf,nbytes,pos);
+  file_uinit(&iov, &u, ubuf, nbytes, UIO_WRITE);
+  u.uio_offset = pos;
+  return file_rw(fdesc, &u, true, retval);
+}
+
+/* Most iovecs readv and writev take without going to kmalloc */
+#define FILE_NIOV 8
+
+/* readv and writev: the iovecs are moved through in order, as one transfer */
+static
+int
+file_rwv(int fdesc, userptr_t uiov, int iovcnt, enum uio_rw rw, int *retval)
+{
+  struct iovec iovbuf[FILE_NIOV], *iovs;
+  struct uio u;
+  int result;
+
+  result = file_uinitv(iovbuf, FILE_NIOV, &iovs, &u, uiov, iovcnt, rw);
+  if (result) {
+    return result;
+  }
+  result = file_rw(fdesc, &u, false, retval);
+  if (iovs != NULL) {
+    kfree(iovs);
+  }
+  return result;
+}
+
+int
+sys_readv(int fdesc, userptr_t uiov, int iovcnt, int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: readv(%d,%x,%d)\n",fdesc,(unsigned int)uiov,iovcnt);
+  return file_rwv(fdesc, uiov, iovcnt, UIO_READ, retval);
+}
+
+int
+sys_writev(int fdesc, userptr_t uiov, int iovcnt, int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: writev(%d,%x,%d)\n",fdesc,(unsigned int)uiov,iovcnt);
+  return file_rwv(fdesc, uiov, iovcnt, UIO_WRITE, retval);
+}
+
+int
+sys_lseek(int fdesc, off_t pos, int whence, off_t *retval)
+{
+  struct openfile *of;
+  struct stat st;
+  off_t newpos;
+  int result;
+
+  DEBUG(DB_SYSCALL,"Syscall: lseek(%d,%lld,%d)\n",fdesc,pos,whence);
+
+  result = filetable_get(curproc->p_filetable, fdesc, &of);
+  if (result) {
+    return result;
+  }
+
+  lock_acquire(of->of_lock);
+
+  switch (whence) {
+  case SEEK_SET:
+    newpos = pos;
+    break;
+  case SEEK_CUR:
+    newpos = of->of_offset + pos;
+    break;
+  case SEEK_END:
+    result = VOP_STAT(of->of_vnode, &st);
+    if (result) {
+      lock_release(of->of_lock);
+      return result;
+    }
+    newpos = st.st_size + pos;
+    break;
+  default:
+    lock_release(of->of_lock);
+    return EINVAL;
+  }
+
+  /* this also fails with ESPIPE on the console */
+  result = VOP_TRYSEEK(of->of_vnode, newpos);
+  if (result) {
+    lock_release(of->of_lock);
+    return result;
+  }
+  if (newpos < 0) {
+    lock_release(of->of_lock);
+    return EINVAL;
+  }
+
+  of->of_offset = newpos;
+  lock_release(of->of_lock);
+
+  *retval = newpos;
+  return 0;
+}
+
+int
+sys_pipe(userptr_t ufds, int *retval)
+{
+  struct vnode *readend, *writeend;
+  struct openfile *readof, *writeof, *junk;
+  int fds[2];
+  int result;
+
+  DEBUG(DB_SYSCALL,"Syscall: pipe(%x)\n",(unsigned int)ufds);
+
+  result = pipe_create(&readend, &writeend);
+  if (result) {
+    return result;
+  }
+
+  result = openfile_create(readend, O_RDONLY, &readof);
+  if (result) {
+    vfs_close(readend);
+    vfs_close(writeend);
+    return result;
+  }
+  result = openfile_create(writeend, O_WRONLY, &writeof);
+  if (result) {
+    openfile_decref(readof);
+    vfs_close(writeend);
+    return result;
+  }
+
+  result = filetable_place(curproc->p_filetable, readof, &fds[0]);
+  if (result) {
+    openfile_decref(readof);
+    openfile_decref(writeof);
+    return result;
+  }
+  result = filetable_place(curproc->p_filetable, writeof, &fds[1]);
+  if (result) {
+    filetable_set(curproc->p_filetable, fds[0], NULL, &junk);
+    openfile_decref(readof);
+    openfile_decref(writeof);
+    return result;
+  }
+
+  result = copyout(fds, ufds, sizeof(fds));
+  if (result) {
+    filetable_set(curproc->p_filetable, fds[0], NULL, &junk);
+    filetable_set(curproc->p_filetable, fds[1], NULL, &junk);
+    openfile_decref(readof);
+    openfile_decref(writeof);
+    return result;
+  }
+
+  *retval = 0;
+  return 0;
+}
+
+int
+sys_close(int fdesc)
+{
+  struct openfile *of;
+  int result;
+
+  DEBUG(DB_SYSCALL,"Syscall: close(%d)\n",fdesc);
+
+  result = filetable_get(curproc->p_filetable, fdesc, &of);
+  if (result) {
+    return result;
+  }
+  filetable_set(curproc->p_filetable, fdesc, NULL, &of);
+  openfile_decref(of);
+  return 0;
+}
+
+int
+sys_dup2(int oldfd, int newfd, int *retval)
+{
+  struct openfile *of, *oldof;
+  int result;
+
+  DEBUG(DB_SYSCALL,"Syscall: dup2(%d,%d)\n",oldfd,newfd);
+
+  result = filetable_get(curproc->p_filetable, oldfd, &of);
+  if (result) {
+    return result;
+  }
+  if (newfd < 0 || newfd >= OPEN_MAX) {
+    return EBADF;
+  }
+
+  if (newfd != oldfd) {
+    openfile_incref(of);
+    filetable_set(curproc->p_filetable, newfd, of, &oldof);
+    if (oldof != NULL) {
+      openfile_decref(oldof);
+    }
+  }
+
+  *retval = newfd;
+  return 0;
+}
+
+#else
+
 
 /* handler for write() system call                  */
 /*
@@ -58,3 +526,5 @@ sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
   KASSERT(*retval >= 0);
   return 0;
 }
+
+#endif /* OPT_A2 */
@@ -0,0 +1,149 @@
+/*
+ * ioring_enter: run a batch of reads, writes and seeks from the rings
+ * in user memory, for one trap. See <kern/ioring.h>.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/ioring.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include "opt-A2.h"
+
+#ifdef OPT_A2
+
+/* Entries copied in and out at a time; they live on the kernel stack */
+#define IORING_BATCH 8
+
+/* Where entry I of a ring, or a field of the ring itself, is in user memory */
+#define IORING_ENTRY(base, i, type) \
+	((userptr_t)((vaddr_t)(base) + (i) * sizeof(type)))
+#define IORING_FIELD(uring, ring, field) \
+	((userptr_t)((vaddr_t)(uring) + \
+		     ((char *)&(ring)->field - (char *)(ring))))
+
+/*
+ * Run one submission through the ordinary system call, and fill in
+ * its completion.
+ */
+static
+void
+ioring_run(const struct ioring_sqe *sqe, struct ioring_cqe *cqe)
+{
+	int result, count = 0;
+	off_t pos = 0;
+
+	switch (sqe->sqe_op) {
+	    case IORING_OP_READ:
+		result = sys_read(sqe->sqe_fd, sqe->sqe_buf, sqe->sqe_len, &count);
+		pos = count;
+		break;
+	    case IORING_OP_WRITE:
+		result = sys_write(sqe->sqe_fd, sqe->sqe_buf, sqe->sqe_len, &count);
+		pos = count;
+		break;
+	    case IORING_OP_LSEEK:
+		result = sys_lseek(sqe->sqe_fd, sqe->sqe_off, sqe->sqe_whence, &pos);
+		break;
+	    default:
+		result = EINVAL;
+		break;
+	}
+
+	cqe->cqe_data = sqe->sqe_data;
+	cqe->cqe_error = result;
+	cqe->cqe_result = result ? -1 : pos;
+}
+
+int
+sys_ioring_enter(userptr_t uring, int *retval)
+{
+	struct ioring ring;
+	struct ioring_sqe sqes[IORING_BATCH];
+	struct ioring_cqe cqes[IORING_BATCH];
+	unsigned mask, todo, done, n, i;
+	int result;
+
+	result = copyin(uring, &ring, sizeof(ring));
+	if (result) {
+		return result;
+	}
+
+	if (ring.ir_entries == 0 || ring.ir_entries > IORING_MAXENTRIES ||
+	    (ring.ir_entries & (ring.ir_entries - 1)) != 0) {
+		return EINVAL;
+	}
+	mask = ring.ir_entries - 1;
+
+	if (ring.ir_sqtail - ring.ir_sqhead > ring.ir_entries ||
+	    ring.ir_cqtail - ring.ir_cqhead > ring.ir_entries) {
+		return EINVAL;
+	}
+
+	/* As many as are waiting, and there is room to complete */
+	todo = ring.ir_sqtail - ring.ir_sqhead;
+	if (todo > ring.ir_entries - (ring.ir_cqtail - ring.ir_cqhead)) {
+		todo = ring.ir_entries - (ring.ir_cqtail - ring.ir_cqhead);
+	}
+
+	for (done = 0; done < todo; done += n) {
+		/* A batch, stopping where either ring wraps */
+		n = todo - done;
+		if (n > IORING_BATCH) {
+			n = IORING_BATCH;
+		}
+		if (n > ring.ir_entries - (ring.ir_sqhead & mask)) {
+			n = ring.ir_entries - (ring.ir_sqhead & mask);
+		}
+		if (n > ring.ir_entries - (ring.ir_cqtail & mask)) {
+			n = ring.ir_entries - (ring.ir_cqtail & mask);
+		}
+
+		result = copyin(IORING_ENTRY(ring.ir_sq, ring.ir_sqhead & mask,
+					     struct ioring_sqe),
+				sqes, n * sizeof(struct ioring_sqe));
+		if (result) {
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			ioring_run(&sqes[i], &cqes[i]);
+		}
+
+		result = copyout(cqes, IORING_ENTRY(ring.ir_cq, ring.ir_cqtail & mask,
+						    struct ioring_cqe),
+				 n * sizeof(struct ioring_cqe));
+		if (result) {
+			/* They ran, but nobody can hear about it; count them anyway */
+			ring.ir_sqhead += n;
+			done += n;
+			break;
+		}
+
+		ring.ir_sqhead += n;
+		ring.ir_cqtail += n;
+	}
+
+	/* Only the counters that are ours, in case the program moves its own */
+	if (done > 0) {
+		result = copyout((void *)&ring.ir_sqhead,
+				 IORING_FIELD(uring, &ring, ir_sqhead),
+				 sizeof(ring.ir_sqhead));
+		if (result == 0) {
+			result = copyout((void *)&ring.ir_cqtail,
+					 IORING_FIELD(uring, &ring, ir_cqtail),
+					 sizeof(ring.ir_cqtail));
+		}
+	}
+
+	/* An error is only an error if nothing got done */
+	if (result && done == 0) {
+		return result;
+	}
+
+	*retval = done;
+	return 0;
+}
+
+#endif /* OPT_A2 */
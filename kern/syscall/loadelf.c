@@ -59,6 +59,7 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <elf.h>
+#include "opt-A3.h"
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -74,6 +75,7 @@
  * change this code to not use uiomove, be sure to check for this case
  * explicitly.
  */
+#if !OPT_A3
 static
 int
 load_segment(struct addrspace *as, struct vnode *v,
@@ -144,6 +146,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 	
 	return result;
 }
+#endif /* !OPT_A3 */
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -251,6 +254,20 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		if (result) {
 			return result;
 		}
+
+#if OPT_A3
+		/* Record where the contents are; vm_fault reads them in */
+		if (ph.p_filesz > ph.p_memsz) {
+			kprintf("ELF: warning: segment filesize > segment memsize\n");
+			ph.p_filesz = ph.p_memsz;
+		}
+
+		result = as_define_file(as, v, ph.p_offset, ph.p_vaddr,
+					ph.p_filesz);
+		if (result) {
+			return result;
+		}
+#endif
 	}
 
 	result = as_prepare_load(as);
@@ -258,6 +275,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		return result;
 	}
 
+#if !OPT_A3
 	/*
 	 * Now actually load each segment.
 	 */
@@ -295,6 +313,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return result;
 		}
 	}
+#endif /* !OPT_A3 */
 
 	result = as_complete_load(as);
 	if (result) {
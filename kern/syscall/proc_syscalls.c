@@ -7,32 +7,36 @@
 #include <current.h>
 #include <proc.h>
 #include <thread.h>
+#include <synch.h>
 #include <addrspace.h>
 #include <copyinout.h>
 #include <mips/trapframe.h>
+#include <limits.h>
+#include <vm.h>
 #include "opt-A2.h"
 
 #ifdef OPT_A2
 #include <vfs.h>
 #include <kern/fcntl.h>
+#include <filetable.h>
 #endif //OPT_A2
 
 #ifdef OPT_A2
-//Mutual exclusion for pid assignment in sys_fork()
-extern volatile pid_t pid_counter;
-extern struct spinlock pid_counter_mutex;
-#endif //OPT_A2
 
-#ifdef OPT_A2
+static void sys_vfork_release(struct proc *p);
 
 void sys__exit(int exitcode)
+{
+	proc_exit(_MKWAIT_EXIT(exitcode));
+}
+
+/* Exit with a status already encoded for waitpid: a normal exit, or killed by a signal */
+void proc_exit(int exitstatus)
 {
 	struct addrspace *as;
 	struct proc *p = curproc;
 
-	lock_acquire(p->p_zombie_mutex);
-
-	DEBUG(DB_SYSCALL, "sys_exit | proc:%s (pid:%d) exitcode:%d\n", p->p_name, p->p_pid, exitcode);
+	DEBUG(DB_SYSCALL, "sys_exit | proc:%s (pid:%d) exitstatus:%d\n", p->p_name, p->p_pid, exitstatus);
 
 	KASSERT(curproc->p_addrspace != NULL);
 	as_deactivate();
@@ -44,50 +48,34 @@ void sys__exit(int exitcode)
 	 * messily fatal.
 	 */
 	as = curproc_setas(NULL);
-	as_destroy(as);
+	if (p->p_vforkdone != NULL) {
+		/* It was our parent's (vfork); give it back */
+		sys_vfork_release(p);
+	} else {
+		as_destroy(as);
+	}
+
+	/* Close our files now rather than when we are reaped, so that
+	 * whoever shares them isn't kept waiting on a zombie */
+	filetable_destroy(p->p_filetable);
+	p->p_filetable = NULL;
 
 	/* detach this thread from its process */
 	/* note: curproc cannot be used after this call */
 
 	proc_remthread(curthread);
 
-	proc_destroy_zombie_children(p);
+	lock_acquire(proc_waitlock);
 
-	/*
-	 * Three cases when we can fully delete ourselves:
-	 *
-	 * 1. Parent already exited
-	 *
-	 * 2. All our children are dead (what if my parent wants to call waitpid on me?)
-	 *
-	 * 3. Our parent has already called waitpid on us
-	 * (how would we know? ... should we set a flag?)
-	 *
-	 * Right now we are only handling the first case. Is it necessary to handle the second or third cases?
-	 * Probably in real world, but I think the tests should pass even if we don't fully delete all our zombies
-	 * or 'pass enough' at the very least
-	 */
-	
-	/* fully delete ourselves if our parent is dead*/
-	bool fully_delete = false;
+	/* Nobody can wait for our children once we are gone */
+	proc_destroy_zombie_children(p);
 
 	if (p->parent == NULL) {
-		fully_delete = true;
-		DEBUG(DB_SYSCALL,"_exit | proc:%s (pid:%d) fully deleting itself because no parent\n", p->p_name, p->p_pid); 
-	} else {
-		lock_acquire(p->parent->p_zombie_mutex);
-
-		if(p->parent->zombie) {
-			fully_delete = true;
-			DEBUG(DB_SYSCALL,"_exit | proc:%s (pid:%d) fully deleting itself because parent is a zombie\n", p->p_name, p->p_pid); 
-		}
 
-		lock_release(p->parent->p_zombie_mutex);
-	}
-
-	if(fully_delete) {
+		/* Nobody can wait for us either, so fully delete ourselves */
+		DEBUG(DB_SYSCALL,"_exit | proc:%s (pid:%d) fully deleting itself because no parent\n", p->p_name, p->p_pid); 
+		lock_release(proc_waitlock);
 
-		lock_release(p->p_zombie_mutex);
 		/* if this is the last user process in the system, proc_destroy()
 		   will wake up the kernel menu thread */
 		proc_destroy(p);
@@ -97,13 +85,13 @@ void sys__exit(int exitcode)
 		DEBUG(DB_SYSCALL, "_exit | proc:%s (pid:%d) becoming a zombie instead of fully deleting, signaling parent %s (pid:%d)\n", 
 				p->p_name, p->p_pid, p->parent->p_name, p->parent->p_pid);
 
-		/* We are a zombie now so lets signal in case our parent was waiting on us */
-		cv_signal(p->p_zombie_cv, p->p_zombie_mutex);
-
-		p->exitstatus = exitcode;
+		p->exitstatus = exitstatus;
 		p->zombie = true;
 
-		lock_release(p->p_zombie_mutex);
+		/* Our parent reaps us as soon as it sees this, in waitpid */
+		cv_signal(p->parent->p_zombie_cv, proc_waitlock);
+
+		lock_release(proc_waitlock);
 	}
 
 	thread_exit();
@@ -191,90 +179,83 @@ sys_getpid(pid_t *retval)
 #ifdef OPT_A2
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval)
 {
-
+	struct proc *p = curproc;
+	struct proc *child;
 	int exitstatus;
 	int result;
 
-	/* this is just a stub implementation that always reports an
-	   exit status of 0, regardless of the actual exit status of
-	   the specified process.   
-	   In fact, this will return 0 even if the specified process
-	   is still running, and even if it never existed in the first place.
-
-	   Fix this!
-	   */
-
-	/* We are not required to implement any options */
-	if (options != 0) {
-		return(EINVAL);	
+	if (options & ~WNOHANG) {
+		return EINVAL;
 	}
 
-
-	/* for now, just pretend the exitstatus is 0 */
-	exitstatus = 0; //This is the code from exit()? What is this..
-
-	struct proc *p = curproc;
-
-	struct proc *child = proc_getchild(p, pid);
-
-	if (child == NULL) {
-
-		DEBUG(DB_SYSCALL,"sys_waitpid | ERROR: %s is not the parent of pid %d\n", p->p_name, pid);
-		//The PID is not one of your children. No business calling waitpid then.
-		return ECHILD;
+	/* No process groups, so the only wildcard is -1, any child */
+	if (pid <= 0 && pid != -1) {
+		return EINVAL;
 	}
 
-	/* Make sure the PID matches up*/
-	KASSERT(child->p_pid == pid);	
-
-	/* Wait until child becomes a zombie and then destroy it */
-
-	/* Note: we fall asleep on the child's CV, since we are waiting on the child to become 
-	 * a zombie */
-	
-	DEBUG(DB_SYSCALL,"sys_waitpid | proc:%s waiting on process with pid:%d\n", p->p_name, pid);
-
-	lock_acquire(child->p_zombie_mutex);
-
-	while(1)
-	{
+	DEBUG(DB_SYSCALL,"sys_waitpid | proc:%s waiting on pid:%d\n", p->p_name, pid);
 
-		DEBUG(DB_SYSCALL,"sys_waitpid | proc:%s checking if pid:%d is a zombie\n", p->p_name, pid);
-		bool is_zombie = child->zombie;
+	lock_acquire(proc_waitlock);
 
-		if(!is_zombie) {
-			DEBUG(DB_SYSCALL,"sys_waitpid | proc:%s sleeping for %s (pid:%d) to become zombie\n", p->p_name, child->p_name, child->p_pid);
-			cv_wait(child->p_zombie_cv, child->p_zombie_mutex); 
-		} else {
-			DEBUG(DB_SYSCALL,"sys_waitpid | proc:%s awaken since %s (pid:%d) is dead\n", p->p_name, child->p_name, child->p_pid);
-			lock_release(child->p_zombie_mutex);
-			break;	
+	if (pid == -1) {
+		if (childarray_num(p->p_children) == 0) {
+			lock_release(proc_waitlock);
+			return ECHILD;
+		}
+		child = NULL;
+	} else {
+		child = proc_getchild(p, pid);
+		if (child == NULL) {
+			DEBUG(DB_SYSCALL,"sys_waitpid | ERROR: %s is not the parent of pid %d\n", p->p_name, pid);
+			//The PID is not one of your children. No business calling waitpid then.
+			lock_release(proc_waitlock);
+			return ECHILD;
 		}
 	}
 
-	exitstatus = _MKWAIT_EXIT(child->exitstatus);
-
-	DEBUG(DB_SYSCALL,"sys_waitpid | child (pid:%d) of %s exited with status %d\n", pid, p->p_name, exitstatus);
+	/* Wait until the child (or any child) becomes a zombie. Our children
+	 * signal our own cv, so this works the same either way */
+	while (1) {
+		if (pid == -1) {
+			child = proc_findzombie(p);
+			if (child != NULL) {
+				break;
+			}
+		} else if (child->zombie) {
+			break;
+		}
 
-	/* We already got the exit status, so kill the zombie child now */
+		if (options & WNOHANG) {
+			/* Nothing has exited yet */
+			lock_release(proc_waitlock);
+			*retval = 0;
+			return 0;
+		}
 
-	//proc_removechild(p, child);
+		DEBUG(DB_SYSCALL,"sys_waitpid | proc:%s sleeping for pid:%d to become zombie\n", p->p_name, pid);
+		cv_wait(p->p_zombie_cv, proc_waitlock);
+	}
 
-	//DEBUG(DB_SYSCALL,"sys_waitpid | %s(pid:%d) destroying child:%s(pid:%d)\n", p->p_name, p->p_pid, child->p_name, child->p_pid);
+	lock_release(proc_waitlock);
 
-	/* Do I need to destroy the child here? When I exit, this child should be destroyed in sys__exit, when I delete all the process' zombie children */
-	//proc_destroy(child);
+	/* Nobody but us can touch a zombie child, so it's safe without the lock now */
+	exitstatus = child->exitstatus;
+	pid = child->p_pid;
 
-	//copies a block of sizeof(int) from the kernel address &exitstatus to
-	//the user address status
-	//
-	//We should be careful about doing this... so there is a whole function for it.
-	result = copyout((void *)&exitstatus,status,sizeof(int));
+	DEBUG(DB_SYSCALL,"sys_waitpid | child (pid:%d) of %s exited with status %d\n", pid, p->p_name, exitstatus);
 
-	if (result) {
-		return(result);
+	if (status != NULL) {
+		result = copyout((void *)&exitstatus,status,sizeof(int));
+		if (result) {
+			/* Leave the zombie, so the status can still be collected */
+			return(result);
+		}
 	}
 
+	/* We have the exit status, so reap the zombie child now */
+	proc_removechild(p, child);
+	proc_destroy(child);
+
 	*retval = pid;
 
 	return 0;
@@ -321,22 +302,19 @@ sys_waitpid(pid_t pid,
 //////////////////////////////////////////////////////////////
 // sys_fork
 
-volatile pid_t pid_counter;
-struct spinlock *pid_counter_mutex_p;
-
-int sys_fork(struct trapframe *tf, pid_t *retval)
+/*
+ * Make a child of the current process, with address space AS, and
+ * start its thread at ENTRY(DATA). The child owns AS only if this
+ * succeeds. VFORKDONE is for vfork (see sys_vfork), and NULL
+ * otherwise. This is all of fork, vfork and spawn except for where
+ * the child's address space comes from.
+ */
+static
+int sys_fork_child(struct addrspace *as, struct semaphore *vforkdone,
+		   void (*entry)(void *, unsigned long), void *data, pid_t *retval)
 {
 	struct proc *p = curproc;
 
-	//Assign the child in the beginning, so we can use it in the name.
-	//Can help for debugging purposes.
-
-	spinlock_acquire(&pid_counter_mutex);
-	++pid_counter;
-	pid_t child_pid = pid_counter;
-	spinlock_release(&pid_counter_mutex);
-
-
 	//TODO: Make sure child_name works out
 	//I want the child name to appear as {parent_name}-{child_pid}
 
@@ -351,172 +329,358 @@ int sys_fork(struct trapframe *tf, pid_t *retval)
 	strcat(child_name, "-child");
 
 
-	DEBUG(DB_SYSCALL,"sys_fork | pid:%d, child_name:%s (pid:%d)\n", p->p_pid, child_name, child_pid);
-
+	/* This also gives the child its PID, from the PID table */
 	struct proc *child = proc_create_runprogram(child_name);
+	kfree(child_name);
 
 	if (child == NULL) {
-		DEBUG(DB_SYSCALL,"sys_fork | ERROR: Failed to create child (pid:%d)", child_pid);
+		DEBUG(DB_SYSCALL,"sys_fork | ERROR: Failed to create child of %s (pid:%d)\n", p->p_name, p->p_pid);
 		return ENOMEM;
 	}
 
-	/*Create a copy of the address space for the child */
-	struct addrspace *current_as = curproc_getas();
+	pid_t child_pid = child->p_pid;
 
-	struct addrspace *new_as;
+	DEBUG(DB_SYSCALL,"sys_fork | pid:%d, child_name:%s (pid:%d)\n", p->p_pid, child->p_name, child_pid);
 
-	int rc = as_copy(current_as, &new_as);
+	//now associate the child's address space with the new
+	//and initialize other fields too.
+
+	child->p_addrspace = as;
+	child->p_vforkdone = vforkdone;
+	child->parent = curproc;
+
+	/* Add the child as a child of the parent, before it can run and exit */
+
+	int rc = proc_addchild(p, child);
 
 	if (rc != 0)
 	{
-		DEBUG(DB_SYSCALL,"sys_fork | ERROR: Failed to copy address space from %s (pid:%d) to child (pid:%d)\n", p->p_name, p->p_pid, child_pid);
+		DEBUG(DB_SYSCALL," sys_fork | ERROR: Could not add %s as a child to %s\n", child->p_name, p->p_name);
+		child->p_addrspace = NULL;
+		proc_destroy(child);
+		return rc;
+	}
+
+	//Put in the child_pid for debugging
+	rc = thread_fork(curthread->t_name, child, entry, data, (unsigned long) child_pid);
 
-		//Kill the child process (which has no threads).
+	if(rc != 0)
+	{
+		proc_removechild(p, child);
+		child->p_addrspace = NULL;
 		proc_destroy(child);
-		return EADDRNOTAVAIL;
+		return rc;
 	}
 
-	//now associate the child's address space with the new
-	//and initialize other fields too.
+	//set retval to child_pid and return 0.
+	//syscall will handle the trapframe registers
+	*retval = child_pid;
 
-	child->p_addrspace = new_as;
-	child->parent = curproc;
+	return 0;
+}
+
+int sys_fork(struct trapframe *tf, pid_t *retval)
+{
+	struct proc *p = curproc;
 
+	/*Create a copy of the address space for the child */
+	struct addrspace *current_as = curproc_getas();
 
-	// we need to assign the child a new PID.
-	// (In real life, we do need reusable PIDs).		
+	struct addrspace *new_as;
 
-	child->p_pid = child_pid;
+	int rc = as_copy(current_as, &new_as);
+
+	if (rc != 0)
+	{
+		DEBUG(DB_SYSCALL,"sys_fork | ERROR: Failed to copy address space from %s (pid:%d)\n", p->p_name, p->p_pid);
+		return EADDRNOTAVAIL;
+	}
 
 	struct trapframe *tf_copy = kmalloc(sizeof(struct trapframe)); //This will be kfree-ed in the child
 
 	if(tf_copy == NULL)
 	{
-		DEBUG(DB_SYSCALL,"sys_fork | ERROR: kmalloc failure when copying trapframe for child (pid:%d)\n", p->p_pid);
-		proc_destroy(child);
+		DEBUG(DB_SYSCALL,"sys_fork | ERROR: kmalloc failure when copying trapframe for child of pid:%d\n", p->p_pid);
+		as_destroy(new_as);
 		return ENOMEM;
 	}
 
 	*tf_copy = *tf;
 
-	//Put in the child_pid for debugging
-	rc = thread_fork(curthread->t_name, child, enter_forked_process, (void *) tf_copy, (unsigned long) child_pid);
+	rc = sys_fork_child(new_as, NULL, enter_forked_process, tf_copy, retval);
 
-	if(rc != 0)
+	if (rc != 0)
 	{
 		kfree(tf_copy);
-		proc_destroy(child);
+		as_destroy(new_as);
 		return rc;
 	}
 
-	//set retval to child_pid and return 0.
-	//syscall will handle the trapframe registers
-	*retval = child_pid;
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////
+// sys_vfork
+
+/*
+ * Like fork, but the child borrows our address space instead of
+ * getting a copy, and we sleep until it gives it back by calling
+ * execv or exiting. Nothing is copied, so this is what to use when
+ * the child is only going to call execv anyway. Until then, anything
+ * the child does to memory, we see too.
+ */
+int sys_vfork(struct trapframe *tf, pid_t *retval)
+{
+	struct proc *p = curproc;
+	struct semaphore *done;
+	int rc;
+
+	done = sem_create("vfork", 0);
+	if (done == NULL) {
+		return ENOMEM;
+	}
+
+	struct trapframe *tf_copy = kmalloc(sizeof(struct trapframe)); //This will be kfree-ed in the child
+
+	if(tf_copy == NULL)
+	{
+		sem_destroy(done);
+		return ENOMEM;
+	}
 
-	/* Add the child as a child of the parent */
+	*tf_copy = *tf;
 
-	rc = proc_addchild(p, child);
+	rc = sys_fork_child(curproc_getas(), done, enter_forked_process, tf_copy, retval);
 
 	if (rc != 0)
 	{
-		DEBUG(DB_SYSCALL," sys_fork | ERROR: Could not add %s as a child to %s\n", child->p_name, p->p_name);
+		kfree(tf_copy);
+		sem_destroy(done);
 		return rc;
 	}
 
+	DEBUG(DB_SYSCALL,"sys_vfork | proc:%s (pid:%d) waiting for child pid:%d to exec or exit\n", p->p_name, p->p_pid, *retval);
+
+	P(done);
+	sem_destroy(done);
+
 	return 0;
+}
+
+/*
+ * Give the address space a vfork child borrowed back to its parent,
+ * in place of destroying it. Call once curproc no longer uses it.
+ */
+static
+void sys_vfork_release(struct proc *p)
+{
+	KASSERT(p->p_vforkdone != NULL);
 
+	V(p->p_vforkdone);
+	p->p_vforkdone = NULL;
 }
 
 //////////////////////////////////////////////////////////////
 // sys_execv
 
-int sys_execv_count_args(userptr_t args, int *argc)
+/* How much of the argument vector the counting pass looks at at once */
+#define EXECV_CHUNK 32
+
+/*
+ * Measure the user string at USTR, including its NUL, by copying it a
+ * piece at a time through a small buffer. Returns E2BIG if it is more
+ * than MAX bytes.
+ */
+static
+int sys_execv_strlen(vaddr_t ustr, size_t max, size_t *len)
 {
-	int args_so_far = 0;
+	char buf[EXECV_CHUNK * sizeof(vaddr_t)];
+	size_t done = 0, n, got;
 	int result;
 
-	/* This cast is fine, according to piazza */
-	char **kargs = (char **) args;
-
-	while(1)
-	{
-		/* Copy the pointer args + args_so_far to the kernel and then check if its NULL */
-		char *karg;
-
-		/* Use copyin instead of copyinstr because we just want to check if the pointer is NULL */
-		result = copyin((const_userptr_t) (kargs + args_so_far), (void *) &karg, sizeof(char *));
-
-		if(result){
-			DEBUG(DB_SYSCALL, "sys_execv_count_args | ERROR:%d could not copy the %d-th argument to the kernel\n", result, args_so_far);
+	while (1) {
+		n = max - done < sizeof(buf) ? max - done : sizeof(buf);
+		if (n == 0) {
+			return E2BIG;
+		}
+		result = copyinstr((const_userptr_t) (ustr + done), buf, n, &got);
+		if (result == 0) {
+			*len = done + got;
+			return 0;
+		}
+		if (result != ENAMETOOLONG) {
 			return result;
 		}
+		done += n;
+	}
+}
 
-		if(karg == NULL) {
-			/* args is a NULL terminated array of holding elements of char *. we are done counting as soon as 
-			 * we encounter a NULL pointer */
+/*
+ * Count the arguments in the user's argument vector ARGS and work out
+ * how big they are packed for as_define_stack_args. The pointers are
+ * copied a chunk at a time, never past the page the terminating NULL
+ * is on. Returns E2BIG if it comes to more than ARG_MAX.
+ */
+static
+int sys_execv_countargs(vaddr_t uaddr, int *argc, size_t *arglen)
+{
+	vaddr_t ptrs[EXECV_CHUNK];
+	size_t chunk, i, len, total;
+	int n = 0;
+	int result;
 
-			DEBUG(DB_SYSCALL, "sys_execv_count_args | read %d arguments\n", args_so_far);
+	/* The terminating NULL */
+	total = sizeof(vaddr_t);
 
-			*argc = args_so_far;
-			return 0;
-		} 
+	while (1) {
+		chunk = (ROUNDUP(uaddr + 1, PAGE_SIZE) - uaddr) / sizeof(vaddr_t);
+		if (chunk > EXECV_CHUNK) {
+			chunk = EXECV_CHUNK;
+		}
 
-		++args_so_far;
+		result = copyin((const_userptr_t) uaddr, ptrs, chunk * sizeof(vaddr_t));
+		if (result) {
+			DEBUG(DB_SYSCALL, "sys_execv_countargs | ERROR:%d could not copy argument pointers at %p\n", result, (void *) uaddr);
+			return result;
+		}
 
+		for (i = 0; i < chunk; ++i) {
+			if (ptrs[i] == 0) {
+				*argc = n;
+				*arglen = total;
+				return 0;
+			}
+			total += sizeof(vaddr_t);
+			if (total > ARG_MAX) {
+				return E2BIG;
+			}
+			result = sys_execv_strlen(ptrs[i], ARG_MAX - total, &len);
+			if (result) {
+				DEBUG(DB_SYSCALL, "sys_execv_countargs | ERROR:%d could not measure argument %d\n", result, n);
+				return result;
+			}
+			total += len;
+			n++;
+		}
+
+		uaddr += chunk * sizeof(vaddr_t);
 	}
 }
 
-int sys_execv(userptr_t program, userptr_t args)
+/*
+ * Copy the argument vector ARGS in from user space, packed into a new
+ * buffer *ARGBUF the way as_define_stack_args wants it: the array of
+ * pointers first, turned into offsets, then the strings. The buffer is
+ * sized by a counting pass first rather than made ARG_MAX up front; a
+ * kmalloc that big wants 16 contiguous pages, which a memory full of
+ * user pages can't give up however much swap is free. Returns E2BIG
+ * if the arguments come to more than ARG_MAX.
+ */
+int sys_execv_copyin_args(userptr_t args, char **argbuf, int *argc, size_t *arglen)
 {
-	/* To count the number of arguments */
-	int argc = 0;
+	vaddr_t *ptrs;
+	size_t off, len, size;
 	int result;
 
-	result = sys_execv_count_args(args, &argc);
+	if ((vaddr_t) args % sizeof(vaddr_t) != 0) {
+		return EFAULT;
+	}
 
-	if(result) {
+	result = sys_execv_countargs((vaddr_t) args, argc, &size);
+	if (result) {
 		return result;
 	}
 
-	/* Now that we have the number of arguments, we can copy each argument from the userspace to the kernel */
-
-	char *kargs[argc]; 
-
-	/* Temporarily cast to (char **) to access the underlying strings */
-	char **kargs_tmp = (char **) args;
-
-	for(int i = 0; i < argc; ++i)
-	{
-		/* Allocate 128 bytes for each string argument */
-		kargs[i] = kmalloc(128);
+	*argbuf = kmalloc(size);
+	if (*argbuf == NULL) {
+		return ENOMEM;
+	}
+	ptrs = (vaddr_t *) *argbuf;
 
-		if(kargs[i] == NULL) {
-			DEBUG(DB_SYSCALL, "sys_execv | ERROR:%d could not malloc when copying the %d-th argument to the kernel\n", ENOMEM, i);
-			return ENOMEM;
+	/* The counting pass has been over all of these already */
+	result = copyin((const_userptr_t) args, ptrs, *argc * sizeof(vaddr_t));
+	if (result) {
+		kfree(*argbuf);
+		return result;
+	}
+	ptrs[*argc] = 0;
+
+	/* Then the strings, straight after the pointers */
+	off = (*argc + 1) * sizeof(vaddr_t);
+	for (int j = 0; j < *argc; ++j) {
+		result = copyinstr((const_userptr_t) ptrs[j], *argbuf + off, size - off, &len);
+		if (result == ENAMETOOLONG) {
+			/* Grew since it was counted */
+			result = E2BIG;
 		}
-
-		/* Copy the string now */
-		result = copyinstr((const_userptr_t) kargs_tmp[i], kargs[i], 128, NULL);
-
-		if(result){
-			DEBUG(DB_SYSCALL, "sys_execv | ERROR:%d could not copy the %d-th to the kernel as a string\n", result, i);
+		if (result) {
+			DEBUG(DB_SYSCALL, "sys_execv_copyin_args | ERROR:%d could not copy argument %d\n", result, j);
+			kfree(*argbuf);
 			return result;
 		}
+		ptrs[j] = off;
+		off += len;
+	}
+
+	DEBUG(DB_SYSCALL, "sys_execv_copyin_args | read %d arguments, %u bytes\n", *argc, off);
 
-		DEBUG(DB_SYSCALL, "sys_execv | copied the %d-th argument:%s\n", i, kargs[i]);
+	*arglen = off;
+	return 0;
+}
+
+/*
+ * Copy in the program name and arguments for execv or spawn. On
+ * success the caller has to kfree *KPROGNAME and *ARGBUF.
+ */
+static
+int sys_execv_copyin(userptr_t program, userptr_t args, char **kprogname,
+		     char **argbuf, int *argc, size_t *arglen)
+{
+	int result;
+
+	/* One buffer for all the arguments, however many there are */
+	result = sys_execv_copyin_args(args, argbuf, argc, arglen);
+	if (result) {
+		return result;
 	}
 
 	/* Copy the program path from the program in the user space to the kernel */
-	char kprogname[128]; 
-
-	result = copyinstr((const_userptr_t) program, kprogname, 128, NULL);
+	*kprogname = kmalloc(PATH_MAX);
+	if (*kprogname == NULL) {
+		kfree(*argbuf);
+		return ENOMEM;
+	}
 
-	if(result){
+	result = copyinstr((const_userptr_t) program, *kprogname, PATH_MAX, NULL);
+	if (result) {
 		DEBUG(DB_SYSCALL, "sys_execv | ERROR: could not copy program name\n");
-		return(result);
+		kfree(*kprogname);
+		kfree(*argbuf);
+		return result;
 	}
 
-	DEBUG(DB_SYSCALL, "sys_execv | copied program name:%s\n", kprogname);
+	DEBUG(DB_SYSCALL, "sys_execv | copied program name:%s\n", *kprogname);
+
+	return 0;
+}
+
+/*
+ * Load the program KPROGNAME into a new address space, with the
+ * arguments from sys_execv_copyin on its stack, and return the new
+ * address space in *RETAS. This switches to the new address space to
+ * load it and back again after, so curproc keeps its own address
+ * space either way.
+ *
+ * Calls vfs_open on kprogname and thus may destroy it.
+ */
+static
+int sys_execv_load(char *kprogname, char *argbuf, size_t arglen, int argc,
+		   struct addrspace **retas, vaddr_t *entrypoint,
+		   userptr_t *argv, vaddr_t *user_stack_ptr)
+{
+	struct addrspace *as, *old_as;
+	struct vnode *v;
+	int result;
 
 	/* Copied directly from runprogram: it does these steps:
 	 *
@@ -525,69 +689,168 @@ int sys_execv(userptr_t program, userptr_t args)
 	 * 3. load the program with load_elf
 	 */
 
-	struct addrspace *as;
-	struct vnode *v;
-	vaddr_t entrypoint;
-
 	/* Open the file. */
 	result = vfs_open(kprogname, O_RDONLY, 0, &v);
 
 	if (result) {
-		DEBUG(DB_SYSCALL, "sys_execv | ERROR: cannot open file %s\n", kprogname);
+		DEBUG(DB_SYSCALL, "sys_execv | ERROR: cannot open program file\n");
 		return result;
 	}
 
-
-	struct addrspace *old_as = curproc_getas();
-
-	if(old_as == NULL) {
-		DEBUG(DB_SYSCALL, "sys_execv | ERROR: current process %s has NULL address space\n", curproc->p_name);
-		panic("sys_execv | ERROR: execv called on process with no address space\n");
-	}
-
 	/* Create a new address space. */
 	as = as_create();
 	if (as ==NULL) {
 		vfs_close(v);
-		DEBUG(DB_SYSCALL, "sys_execv | ERROR: no memory to create address space for file %s\n", kprogname);
+		DEBUG(DB_SYSCALL, "sys_execv | ERROR: no memory to create address space\n");
 		return ENOMEM;
 	}
 
 	/* Switch to it and activate it. */
-	curproc_setas(as);
+	old_as = curproc_setas(as);
+	as_activate();
+
+	/* Load the executable, and put the arguments on the new stack. */
+	result = load_elf(v, entrypoint);
+	vfs_close(v);
+	if (result == 0) {
+		result = as_define_stack_args(as, argbuf, arglen, argc, argv, user_stack_ptr);
+	}
+
+	/* Back to the old program, which carries on or gets the error */
+	curproc_setas(old_as);
 	as_activate();
 
-	/* Load the executable. */
-	result = load_elf(v, &entrypoint);
 	if (result) {
-		DEBUG(DB_SYSCALL, "sys_execv | ERROR: could not load executable for file %s\n", kprogname);
-		/* p_addrspace will go away when curproc is destroyed */
-		vfs_close(v);
+		DEBUG(DB_SYSCALL, "sys_execv | ERROR:%d could not set up the new program\n", result);
+		as_destroy(as);
 		return result;
 	}
 
-	/* Done with the file now. */
-	vfs_close(v);
-
-	/* Delete the old address space now */
-	as_destroy(old_as);
+	*retas = as;
+	return 0;
+}
 
-	/* Put arguments on the user stack and get the stack ptr simultaneously */
-	vaddr_t user_stack_ptr;
+int sys_execv(userptr_t program, userptr_t args)
+{
+	struct proc *p = curproc;
+	struct addrspace *as, *old_as;
+	vaddr_t entrypoint, user_stack_ptr;
 	userptr_t argv;
+	char *kprogname, *argbuf;
+	size_t arglen;
+	int argc;
+	int result;
 
-	result = as_define_stack_args(as, &argv, &user_stack_ptr, kargs, argc);
+	result = sys_execv_copyin(program, args, &kprogname, &argbuf, &argc, &arglen);
+	if (result) {
+		return result;
+	}
 
-	if(result){
-		DEBUG(DB_SYSCALL, "sys_execv | ERROR:%d when copying arguments onto stack\n", result);
+	result = sys_execv_load(kprogname, argbuf, arglen, argc, &as, &entrypoint, &argv, &user_stack_ptr);
+	kfree(kprogname);
+	kfree(argbuf);
+
+	if (result) {
+		return result;
+	}
+
+	/* Switch to the new program */
+	old_as = curproc_setas(as);
+	as_activate();
+
+	if(old_as == NULL) {
+		DEBUG(DB_SYSCALL, "sys_execv | ERROR: current process %s has NULL address space\n", p->p_name);
+		panic("sys_execv | ERROR: execv called on process with no address space\n");
+	}
+
+	if (p->p_vforkdone != NULL) {
+		/* It was our parent's; give it back */
+		sys_vfork_release(p);
+	} else {
+		/* Delete the old address space now */
+		as_destroy(old_as);
 	}
 
 	/* Warp to user mode */
-	//enter_new_process(0 /*argc*/, NULL /*userspace addr of argv*/, user_stack_ptr, entrypoint);
 	enter_new_process(argc, argv, user_stack_ptr, entrypoint);
 
 	panic("enter_new_process returned\n");
 	return EINVAL;
 }
 
+//////////////////////////////////////////////////////////////
+// sys_spawn
+
+/* Where a spawned child starts, passed from sys_spawn to sys_spawn_start */
+struct spawn_start {
+	vaddr_t ss_entrypoint;
+	vaddr_t ss_stackptr;
+	userptr_t ss_argv;
+	int ss_argc;
+};
+
+static
+void sys_spawn_start(void *data, unsigned long child_pid)
+{
+	struct spawn_start ss = *(struct spawn_start *) data;
+
+	kfree(data);
+	(void) child_pid;
+
+	/* Warp to user mode */
+	enter_new_process(ss.ss_argc, ss.ss_argv, ss.ss_stackptr, ss.ss_entrypoint);
+
+	panic("enter_new_process returned\n");
+}
+
+/*
+ * fork and execv in one: start PROGRAM with ARGS in a new child
+ * process, and return its PID. The program is loaded straight into the
+ * child's new address space, so nothing is copied that execv would
+ * only throw away, and a program that can't be run is an error from
+ * here rather than from a child that then has to exit.
+ */
+int sys_spawn(userptr_t program, userptr_t args, pid_t *retval)
+{
+	struct spawn_start *ss;
+	struct addrspace *as;
+	char *kprogname, *argbuf;
+	size_t arglen;
+	int argc;
+	int result;
+
+	result = sys_execv_copyin(program, args, &kprogname, &argbuf, &argc, &arglen);
+	if (result) {
+		return result;
+	}
+
+	ss = kmalloc(sizeof(struct spawn_start)); //This will be kfree-ed in the child
+	if (ss == NULL) {
+		kfree(kprogname);
+		kfree(argbuf);
+		return ENOMEM;
+	}
+
+	result = sys_execv_load(kprogname, argbuf, arglen, argc, &as, &ss->ss_entrypoint, &ss->ss_argv, &ss->ss_stackptr);
+	kfree(kprogname);
+	kfree(argbuf);
+
+	if (result) {
+		kfree(ss);
+		return result;
+	}
+
+	ss->ss_argc = argc;
+
+	result = sys_fork_child(as, NULL, sys_spawn_start, ss, retval);
+
+	if (result) {
+		kfree(ss);
+		as_destroy(as);
+		return result;
+	}
+
+	return 0;
+}
+
 #endif /* OPT_A2 */
@@ -36,6 +36,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <limits.h>
 #include <lib.h>
 #include <proc.h>
 #include <current.h>
@@ -45,6 +46,47 @@
 #include <syscall.h>
 #include <test.h>
 
+/*
+ * Pack ARGC strings from ARGS into one buffer laid out the way
+ * as_define_stack_args wants it, the same as execv does.
+ */
+static
+int
+runprogram_packargs(char **args, int argc, char **retbuf, size_t *retlen)
+{
+	vaddr_t *ptrs;
+	char *argbuf;
+	size_t arglen, len;
+	int i;
+
+	arglen = (argc + 1) * sizeof(vaddr_t);
+	for (i = 0; i < argc; i++) {
+		arglen += strlen(args[i]) + 1;
+		if (arglen > ARG_MAX) {
+			return E2BIG;
+		}
+	}
+
+	argbuf = kmalloc(arglen);
+	if (argbuf == NULL) {
+		return ENOMEM;
+	}
+
+	ptrs = (vaddr_t *)argbuf;
+	arglen = (argc + 1) * sizeof(vaddr_t);
+	for (i = 0; i < argc; i++) {
+		len = strlen(args[i]) + 1;
+		memcpy(argbuf + arglen, args[i], len);
+		ptrs[i] = arglen;
+		arglen += len;
+	}
+	ptrs[argc] = 0;
+
+	*retbuf = argbuf;
+	*retlen = arglen;
+	return 0;
+}
+
 /*
  * Load program "progname" and start running it in usermode.
  * Does not return except on error.
@@ -57,11 +99,20 @@ runprogram(char *progname, char **args, int argc)
 	struct addrspace *as;
 	struct vnode *v;
 	vaddr_t entrypoint, stackptr;
+	userptr_t argv;
+	char *argbuf;
+	size_t arglen;
 	int result;
 
+	result = runprogram_packargs(args, argc, &argbuf, &arglen);
+	if (result) {
+		return result;
+	}
+
 	/* Open the file. */
 	result = vfs_open(progname, O_RDONLY, 0, &v);
 	if (result) {
+		kfree(argbuf);
 		return result;
 	}
 
@@ -72,6 +123,7 @@ runprogram(char *progname, char **args, int argc)
 	as = as_create();
 	if (as ==NULL) {
 		vfs_close(v);
+		kfree(argbuf);
 		return ENOMEM;
 	}
 
@@ -84,15 +136,16 @@ runprogram(char *progname, char **args, int argc)
 	if (result) {
 		/* p_addrspace will go away when curproc is destroyed */
 		vfs_close(v);
+		kfree(argbuf);
 		return result;
 	}
 
 	/* Done with the file now. */
 	vfs_close(v);
 
-	userptr_t argv;
 	/* Define the user stack in the address space, and put arguments on the stack */
-	result = as_define_stack_args(as, &argv, &stackptr, args, argc);
+	result = as_define_stack_args(as, argbuf, arglen, argc, &argv, &stackptr);
+	kfree(argbuf);
 
 	if (result) {
 		/* p_addrspace will go away when curproc is destroyed */
@@ -28,9 +28,13 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <lib.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
+#include "opt-A2.h"
 
 /*
  * Example system call: get the time of day.
@@ -56,3 +60,95 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+#ifdef OPT_A2
+/*
+ * clock_gettime, to the nanosecond. libc reads the _COARSE clocks
+ * from the time page itself, but they work here too.
+ */
+int
+sys___clock_gettime(int clockid, userptr_t user_timespec_ptr)
+{
+	struct timespec ts;
+	time_t seconds, bootseconds;
+	uint32_t nanoseconds, bootnanoseconds;
+
+	switch (clockid) {
+	    case CLOCK_REALTIME:
+	    case CLOCK_MONOTONIC:
+		gettime(&seconds, &nanoseconds);
+		break;
+	    case CLOCK_REALTIME_COARSE:
+	    case CLOCK_MONOTONIC_COARSE:
+		gettime_coarse(&seconds, &nanoseconds);
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (clockid == CLOCK_MONOTONIC || clockid == CLOCK_MONOTONIC_COARSE) {
+		getboottime(&bootseconds, &bootnanoseconds);
+		getinterval(bootseconds, bootnanoseconds,
+			    seconds, nanoseconds,
+			    &seconds, &nanoseconds);
+	}
+
+	ts.tv_sec = seconds;
+	ts.tv_nsec = nanoseconds;
+
+	return copyout(&ts, user_timespec_ptr, sizeof(ts));
+}
+
+/* Longest single sleep; it has to fit in clocksleep_usec's usec count */
+#define NANOSLEEP_CHUNK 1000
+
+/*
+ * nanosleep. The sleeper sleeps until a deadline worked out up front,
+ * in chunks the timer wheel can take, so the rounding of each chunk
+ * (up to a timer tick, see clocksleep_usec) doesn't add up. Nothing
+ * interrupts it, so the time remaining is always 0.
+ */
+int
+sys_nanosleep(userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec ts;
+	time_t secs, endsecs;
+	uint32_t nsecs, endnsecs;
+	int result;
+
+	result = copyin((const_userptr_t)user_req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	gettime(&secs, &nsecs);
+	endsecs = secs + ts.tv_sec;
+	endnsecs = nsecs + ts.tv_nsec;
+	if (endnsecs >= 1000000000) {
+		endnsecs -= 1000000000;
+		endsecs++;
+	}
+
+	while (secs < endsecs || (secs == endsecs && nsecs < endnsecs)) {
+		getinterval(secs, nsecs, endsecs, endnsecs, &secs, &nsecs);
+		if (secs >= NANOSLEEP_CHUNK) {
+			clocksleep_usec(NANOSLEEP_CHUNK * 1000000U);
+		}
+		else {
+			clocksleep_usec(secs * 1000000U +
+					DIVROUNDUP(nsecs, 1000));
+		}
+		gettime(&secs, &nsecs);
+	}
+
+	if (user_rem != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		result = copyout(&ts, user_rem, sizeof(ts));
+	}
+	return result;
+}
+#endif /* OPT_A2 */
@@ -0,0 +1,25 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <syscall.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+
+/*
+ * sbrk: move the end of the heap by AMOUNT bytes and return where it
+ * used to be. Pages are only allocated when the process touches them,
+ * and are given back when the break moves down past them.
+ */
+int
+sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+	struct addrspace *as;
+
+	DEBUG(DB_SYSCALL, "Syscall: sbrk(%d)\n", (int)amount);
+
+	as = curproc_getas();
+	KASSERT(as != NULL);
+
+	return as_sbrk(as, amount, retval);
+}
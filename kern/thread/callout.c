@@ -0,0 +1,232 @@
+/*
+ * Callouts, in a hierarchical timer wheel. See callout.h.
+ *
+ * The wheel has four levels. Level 0 has a slot for each of the next
+ * 256 ticks. Each slot of level 1 covers 256 ticks, so its 64 slots
+ * see 2^14 ticks ahead; level 2's slots cover 2^14 ticks each, and
+ * level 3's 2^20, which sees 2^26 ticks (about a week) ahead. A
+ * callout goes in the slot, at the finest level that reaches, for the
+ * tick it is due at.
+ *
+ * Each tick runs level 0's slot for that tick. Every 256 ticks, when
+ * level 0 comes round again, the next slot of level 1 is emptied back
+ * into the wheel, which spreads it out over level 0; every 64 of
+ * those, the next slot of level 2 is emptied the same way, and so on.
+ * So a callout is moved at most three times before it goes off, and
+ * nothing is ever looked at before it has to be.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <callout.h>
+#include <lamebus/ltimer.h>
+#include "opt-A2.h"
+
+#ifdef OPT_A2
+
+#define WHEEL0_BITS	8
+#define WHEEL_BITS	6
+#define WHEEL_LEVELS	3		/* besides level 0 */
+#define WHEEL0_SIZE	(1U << WHEEL0_BITS)
+#define WHEEL_SIZE	(1U << WHEEL_BITS)
+
+/* Shift of the tick number that gives level L's slot, for L >= 1 */
+#define WHEEL_SHIFT(l)	(WHEEL0_BITS + ((l) - 1) * WHEEL_BITS)
+
+/* Furthest ahead the wheel sees */
+#define WHEEL_MAXTICKS	((1U << (WHEEL0_BITS + WHEEL_LEVELS * WHEEL_BITS)) - 1)
+
+static struct spinlock callout_lock = SPINLOCK_INITIALIZER;
+
+static struct callout *wheel0[WHEEL0_SIZE];
+static struct callout *wheel[WHEEL_LEVELS][WHEEL_SIZE];	/* levels 1-3 */
+
+/* The tick callout_tick will run next */
+static uint32_t callout_next;
+
+/* The callout whose function is being called, if any */
+static struct callout *callout_running;
+
+void
+callout_init(struct callout *co)
+{
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+	co->co_func = NULL;
+	co->co_arg = NULL;
+	co->co_expires = 0;
+}
+
+/* Put CO at the head of the list at HEAD. */
+static
+void
+callout_push(struct callout **head, struct callout *co)
+{
+	co->co_next = *head;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = &co->co_next;
+	}
+	co->co_prevp = head;
+	*head = co;
+}
+
+/* Take CO off whatever list it is on. */
+static
+void
+callout_unlink(struct callout *co)
+{
+	KASSERT(co->co_prevp != NULL);
+
+	*co->co_prevp = co->co_next;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = co->co_prevp;
+	}
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+}
+
+/* Put CO in the wheel for its co_expires. Callout lock held. */
+static
+void
+callout_place(struct callout *co)
+{
+	uint32_t delta, expires;
+	unsigned l;
+
+	expires = co->co_expires;
+	delta = expires - callout_next;
+
+	if ((int32_t)delta < 0) {
+		/* Overdue (only from cascading): the very next tick */
+		callout_push(&wheel0[callout_next % WHEEL0_SIZE], co);
+		return;
+	}
+	if (delta < WHEEL0_SIZE) {
+		callout_push(&wheel0[expires % WHEEL0_SIZE], co);
+		return;
+	}
+	for (l = 1; l < WHEEL_LEVELS; l++) {
+		if (delta < (1U << WHEEL_SHIFT(l + 1))) {
+			break;
+		}
+	}
+	callout_push(&wheel[l - 1][(expires >> WHEEL_SHIFT(l)) % WHEEL_SIZE],
+		     co);
+}
+
+void
+callout_schedule(struct callout *co, void (*func)(void *), void *arg,
+		 unsigned usec)
+{
+	uint32_t ticks;
+
+	/*
+	 * Never early, so round up, and don't count the tick that is
+	 * already under way: the next one may be only a moment off, so
+	 * it goes off on the one after TICKS whole ticks have passed.
+	 */
+	ticks = DIVROUNDUP(usec, LT_GRANULARITY);
+	if (ticks > WHEEL_MAXTICKS) {
+		ticks = WHEEL_MAXTICKS;
+	}
+
+	spinlock_acquire(&callout_lock);
+	if (co->co_prevp != NULL) {
+		callout_unlink(co);
+	}
+	co->co_func = func;
+	co->co_arg = arg;
+	co->co_expires = callout_next + ticks;
+	callout_place(co);
+	spinlock_release(&callout_lock);
+}
+
+bool
+callout_cancel(struct callout *co)
+{
+	bool pending;
+
+	spinlock_acquire(&callout_lock);
+	pending = (co->co_prevp != NULL);
+	if (pending) {
+		callout_unlink(co);
+	}
+	/*
+	 * Callouts run in the timer interrupt, so if this one is
+	 * running it's on another cpu. It won't be long.
+	 */
+	while (callout_running == co) {
+		spinlock_release(&callout_lock);
+		spinlock_acquire(&callout_lock);
+	}
+	spinlock_release(&callout_lock);
+
+	return pending;
+}
+
+/*
+ * Empty slot INDEX of level L back into the wheel, which now puts
+ * everything in it at a finer level. Returns INDEX, so the caller
+ * knows whether this level has come round too.
+ */
+static
+unsigned
+callout_cascade(unsigned l, unsigned index)
+{
+	struct callout *co;
+
+	while ((co = wheel[l - 1][index]) != NULL) {
+		callout_unlink(co);
+		callout_place(co);
+	}
+	return index;
+}
+
+void
+callout_tick(void)
+{
+	struct callout *work, *co;
+	void (*func)(void *);
+	void *arg;
+	unsigned index, l;
+
+	spinlock_acquire(&callout_lock);
+
+	index = callout_next % WHEEL0_SIZE;
+	if (index == 0) {
+		/* Level 0 has come round; refill it from above */
+		for (l = 1; l <= WHEEL_LEVELS; l++) {
+			if (callout_cascade(l, (callout_next >> WHEEL_SHIFT(l))
+					    % WHEEL_SIZE) != 0) {
+				break;
+			}
+		}
+	}
+	callout_next++;
+
+	/* Take the whole slot, so anything scheduled from here goes elsewhere */
+	work = wheel0[index];
+	wheel0[index] = NULL;
+	if (work != NULL) {
+		work->co_prevp = &work;
+	}
+
+	while ((co = work) != NULL) {
+		callout_unlink(co);
+		func = co->co_func;
+		arg = co->co_arg;
+
+		/* Call it unlocked, so it can schedule or cancel callouts */
+		callout_running = co;
+		spinlock_release(&callout_lock);
+		func(arg);
+		spinlock_acquire(&callout_lock);
+		callout_running = NULL;
+	}
+
+	spinlock_release(&callout_lock);
+}
+
+#endif /* OPT_A2 */
@@ -35,6 +35,14 @@
 #include <thread.h>
 #include <lamebus/ltimer.h>
 #include <current.h>
+#include "opt-A2.h"
+
+#ifdef OPT_A2
+#include <kern/errno.h>
+#include <vm.h>
+#include <kern/timepage.h>
+#include <callout.h>
+#endif /* OPT_A2 */
 
 /*
  * Time handling.
@@ -54,6 +62,14 @@
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
+#ifdef OPT_A2
+/*
+ * clocksleep and clocknap sleep here, each with its own timeout
+ * (see callout.c), so each wakes once, when it's time. Nobody ever
+ * wakes the channel itself.
+ */
+static struct wchan *napchan;
+#else
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
  */
@@ -72,6 +88,15 @@ static struct wchan *minibolt;
  * minibolt countdown
  */
 static int minicount;
+#endif /* OPT_A2 */
+
+#ifdef OPT_A2
+/*
+ * The time page. Only timerclock() writes it, which runs on one cpu,
+ * so tp_seq needs no lock.
+ */
+static struct timepage *timepage;
+#endif /* OPT_A2 */
 
 /*
  * Setup.
@@ -79,6 +104,12 @@ static int minicount;
 void
 hardclock_bootstrap(void)
 {
+#ifdef OPT_A2
+	napchan = wchan_create("clocksleep");
+	if (napchan == NULL) {
+		panic("Couldn't create clocksleep\n");
+	}
+#else
 	lbolt = wchan_create("lbolt");
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
@@ -90,8 +121,86 @@ hardclock_bootstrap(void)
 	minicount = MINI_PER_SECOND;
 	/* we assume MINI_PER_SECOND > 0 */
 	KASSERT(minicount > 0);
+#endif /* OPT_A2 */
 }
 
+#ifdef OPT_A2
+/*
+ * Set up the time page. Needs the clock, so it has to wait until the
+ * devices are attached.
+ */
+void
+timepage_bootstrap(void)
+{
+	struct timepage *tp;
+	time_t secs;
+	uint32_t nsecs;
+	vaddr_t page;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		panic("Couldn't allocate the time page\n");
+	}
+	bzero((void *)page, PAGE_SIZE);
+	tp = (struct timepage *)page;
+
+	gettime(&secs, &nsecs);
+	tp->tp_sec = tp->tp_bootsec = secs;
+	tp->tp_nsec = tp->tp_bootnsec = nsecs;
+
+	/* Only now can timerclock see it */
+	timepage = tp;
+}
+
+paddr_t
+timepage_paddr(void)
+{
+	KASSERT(timepage != NULL);
+	return (vaddr_t)timepage - MIPS_KSEG0;
+}
+
+void
+gettime_coarse(time_t *seconds, uint32_t *nanoseconds)
+{
+	uint32_t seq;
+
+	do {
+		while ((seq = timepage->tp_seq) & 1) {
+			/* timerclock is in the middle of it */
+		}
+		*seconds = timepage->tp_sec;
+		*nanoseconds = timepage->tp_nsec;
+	} while (timepage->tp_seq != seq);
+}
+
+void
+getboottime(time_t *seconds, uint32_t *nanoseconds)
+{
+	/* Never changes */
+	*seconds = timepage->tp_bootsec;
+	*nanoseconds = timepage->tp_bootnsec;
+}
+
+/*
+ * Record the time in the time page. Called from timerclock.
+ */
+static
+void
+timepage_update(void)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	gettime(&secs, &nsecs);
+
+	timepage->tp_seq++;
+	timepage->tp_ticks++;
+	timepage->tp_sec = secs;
+	timepage->tp_nsec = nsecs;
+	timepage->tp_seq++;
+}
+#endif /* OPT_A2 */
+
 /*
  * This is called once every every LT_GRANULARITY usec, on one processor,
  * by the timer code.
@@ -99,6 +208,14 @@ hardclock_bootstrap(void)
 void
 timerclock(void)
 {
+#ifdef OPT_A2
+	if (timepage != NULL) {
+		timepage_update();
+	}
+
+	/* Whatever is due, and nothing else */
+	callout_tick();
+#else
 	/* Broadcast on minibolt */
 	wchan_wakeall(minibolt);
 	/* Broadcast on lbolt if a second has elapsed */
@@ -106,6 +223,7 @@ timerclock(void)
 	  minicount = MINI_PER_SECOND;
 	  wchan_wakeall(lbolt);
 	}
+#endif /* OPT_A2 */
 }
 
 /*
@@ -126,8 +244,28 @@ hardclock(void)
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
+#ifdef OPT_A2
+	thread_tick();
+#else
 	thread_yield();
+#endif
+}
+
+#ifdef OPT_A2
+/*
+ * Sleep for USEC microseconds.
+ */
+void
+clocksleep_usec(unsigned usec)
+{
+  int result;
+
+  wchan_lock(napchan);
+  result = wchan_sleep_timeout(napchan, usec);
+  /* nobody else wakes napchan */
+  KASSERT(result == ETIMEDOUT);
 }
+#endif /* OPT_A2 */
 
 /*
  * Suspend execution for n seconds.
@@ -135,11 +273,20 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
+#ifdef OPT_A2
+  /* a few thousand seconds at a time fit in the usec count */
+  while (num_secs > 0) {
+    int n = num_secs < 1000 ? num_secs : 1000;
+    clocksleep_usec(n * 1000000U);
+    num_secs -= n;
+  }
+#else
   while (num_secs > 0) {
     wchan_lock(lbolt);
     wchan_sleep(lbolt);
     num_secs--;
   }
+#endif /* OPT_A2 */
 }
 
 /*
@@ -149,9 +296,15 @@ clocksleep(int num_secs)
 void
 clocknap(int num_ticks)
 {
+#ifdef OPT_A2
+  if (num_ticks > 0) {
+    clocksleep_usec(num_ticks * LT_GRANULARITY);
+  }
+#else
   while (num_ticks > 0) {
     wchan_lock(minibolt);
     wchan_sleep(minibolt);
     num_ticks--;
   }
+#endif /* OPT_A2 */
 }
@@ -50,13 +50,25 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <syscall.h>
+#include <clock.h>
+#include <callout.h>
 
 #include "opt-synchprobs.h"
+#include "opt-A2.h"
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+#ifdef OPT_A2
+/* Scheduler tuning; see schedule(). All are in hardclocks. */
+#define SCHED_DEFAULT_QUANTUM	1		/* c_quantum to start with */
+#define SCHED_MAX_QUANTUM	HZ		/* most c_quantum can be set to */
+#define SCHED_QUANTUM(c, level)	((c)->c_quantum << (level)) /* 1, 2, 4, 8 */
+#define SCHED_BOOST_HARDCLOCKS	HZ		/* everyone to the top once a second */
+#endif
+
 /* Wait channel. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -111,6 +123,66 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+#ifdef OPT_A2
+/*
+ * Name THREAD, in t_namebuf if the name fits.
+ */
+static
+int
+thread_setname(struct thread *thread, const char *name)
+{
+	if (strlen(name) < THREAD_NAMEBUF) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
+		return 0;
+	}
+	thread->t_name = kstrdup(name);
+	return thread->t_name == NULL ? ENOMEM : 0;
+}
+
+static
+void
+thread_freename(struct thread *thread)
+{
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
+	}
+	thread->t_name = NULL;
+}
+#endif /* OPT_A2 */
+
+/*
+ * Set the fields of a thread that is starting out, whether it is
+ * new or being reused (thread_fork). Leaves the name and stack alone.
+ */
+static
+void
+thread_initfields(struct thread *thread)
+{
+	thread->t_wchan_name = "NEW";
+	thread->t_state = S_READY;
+
+	/* Thread subsystem fields */
+	thread_machdep_init(&thread->t_machdep);
+	thread->t_context = NULL;
+	thread->t_cpu = NULL;
+	thread->t_proc = NULL;
+
+	/* Interrupt state fields */
+	thread->t_in_interrupt = false;
+	thread->t_curspl = IPL_HIGH;
+	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+
+#ifdef OPT_A2
+	/* Scheduler fields: new threads start at the top */
+	thread->t_level = 0;
+	thread->t_ticks = 0;
+	thread->t_wchan = NULL;
+#endif
+
+	/* If you add to struct thread, be sure to initialize here */
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -128,28 +200,21 @@ thread_create(const char *name)
 		return NULL;
 	}
 
+#ifdef OPT_A2
+	if (thread_setname(thread, name)) {
+		kfree(thread);
+		return NULL;
+	}
+#else
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
 		kfree(thread);
 		return NULL;
 	}
-	thread->t_wchan_name = "NEW";
-	thread->t_state = S_READY;
-
-	/* Thread subsystem fields */
-	thread_machdep_init(&thread->t_machdep);
+#endif
 	threadlistnode_init(&thread->t_listnode, thread);
 	thread->t_stack = NULL;
-	thread->t_context = NULL;
-	thread->t_cpu = NULL;
-	thread->t_proc = NULL;
-
-	/* Interrupt state fields */
-	thread->t_in_interrupt = false;
-	thread->t_curspl = IPL_HIGH;
-	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
-
-	/* If you add to struct thread, be sure to initialize here */
+	thread_initfields(thread);
 
 	return thread;
 }
@@ -168,6 +233,9 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+#ifdef OPT_A2
+	unsigned i;
+#endif
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -180,9 +248,34 @@ cpu_create(unsigned hardware_number)
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
+#if OPT_A3
+	/* No generation yet; the first as_activate flushes the TLB */
+	c->c_asid_generation = 0;
+	c->c_asid = 0;
+#endif
+#ifdef OPT_A2
+	c->c_syscallstats = syscall_stats_create();
+	if (c->c_syscallstats == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
+	c->c_quantum = SCHED_DEFAULT_QUANTUM;
+	c->c_idleclock = false;
+	threadlist_init(&c->c_threadcache);
+	c->c_threadcache_hits = 0;
+	c->c_threadcache_misses = 0;
+	c->c_threadcache_puts = 0;
+	c->c_threadcache_frees = 0;
+#endif
 
 	c->c_isidle = false;
+#ifdef OPT_A2
+	for (i = 0; i < SCHED_NLEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
+#else
 	threadlist_init(&c->c_runqueue);
+#endif
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
@@ -227,6 +320,110 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+#ifdef OPT_A2
+/*
+ * The thread cache.
+ *
+ * Rather than free an exited thread, thread_destroy keeps it, stack
+ * and all, on its cpu's c_threadcache, and thread_fork takes one from
+ * there rather than allocate, so forking and exiting don't go near
+ * kmalloc once things have settled down. The cache is per-cpu, so it
+ * needs no lock, only splhigh; threads exit on the cpu they ran on,
+ * and new ones come from the cpu that forks them, so a cpu that
+ * forks a lot and one where they exit won't necessarily share. Each
+ * keeps at most THREAD_CACHE_MAX.
+ */
+#define THREAD_CACHE_MAX 8
+
+/*
+ * Keep THREAD in the cache if there's room. Returns true if it was
+ * kept.
+ */
+static
+bool
+thread_cache_put(struct thread *thread)
+{
+	struct cpu *c;
+	int spl;
+
+	if (thread->t_stack == NULL) {
+		/* Never got going; a cached thread always has a stack */
+		return false;
+	}
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	if (c->c_threadcache.tl_count >= THREAD_CACHE_MAX) {
+		c->c_threadcache_frees++;
+		splx(spl);
+		return false;
+	}
+	thread_machdep_cleanup(&thread->t_machdep);
+	thread->t_wchan_name = "CACHED";
+	thread_freename(thread);
+	threadlist_addhead(&c->c_threadcache, thread);
+	c->c_threadcache_puts++;
+	splx(spl);
+
+	return true;
+}
+
+/*
+ * Take a thread from the cache and set it up as new, called NAME.
+ * Returns NULL if the cache is empty. The most recently exited comes
+ * first, since its stack is the most likely to be in the cache.
+ */
+static
+struct thread *
+thread_cache_get(const char *name)
+{
+	struct cpu *c;
+	struct thread *thread;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	thread = threadlist_remhead(&c->c_threadcache);
+	if (thread != NULL) {
+		c->c_threadcache_hits++;
+	}
+	else {
+		c->c_threadcache_misses++;
+	}
+	splx(spl);
+
+	if (thread == NULL) {
+		return NULL;
+	}
+	KASSERT(thread->t_stack != NULL);
+	if (thread_setname(thread, name)) {
+		/* Still as cached, so it can go straight back */
+		spl = splhigh();
+		threadlist_addhead(&curcpu->c_self->c_threadcache, thread);
+		splx(spl);
+		return NULL;
+	}
+	thread_initfields(thread);
+	return thread;
+}
+
+void
+thread_printcachestats(void)
+{
+	struct cpu *c;
+	unsigned i;
+
+	for (i = 0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("cpu%u: %u cached, %u hits, %u misses, "
+			"%u kept, %u freed\n",
+			c->c_number, c->c_threadcache.tl_count,
+			c->c_threadcache_hits, c->c_threadcache_misses,
+			c->c_threadcache_puts, c->c_threadcache_frees);
+	}
+}
+#endif /* OPT_A2 */
+
 /*
  * Destroy a thread.
  *
@@ -249,6 +446,11 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
+#ifdef OPT_A2
+	if (thread_cache_put(thread)) {
+		return;
+	}
+#endif
 	if (thread->t_stack != NULL) {
 		kfree(thread->t_stack);
 	}
@@ -258,7 +460,11 @@ thread_destroy(struct thread *thread)
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
+#ifdef OPT_A2
+	thread_freename(thread);
+#else
 	kfree(thread->t_name);
+#endif
 	kfree(thread);
 }
 
@@ -303,9 +509,22 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
+#ifdef OPT_A2
+	{
+		unsigned i;
+
+		for (i = 0; i < SCHED_NLEVELS; i++) {
+			curcpu->c_runqueue[i].tl_count = 0;
+			curcpu->c_runqueue[i].tl_head.tln_next = NULL;
+			curcpu->c_runqueue[i].tl_tail.tln_prev = NULL;
+		}
+		curcpu->c_runcount = 0;
+	}
+#else
 	curcpu->c_runqueue.tl_count = 0;
 	curcpu->c_runqueue.tl_head.tln_next = NULL;
 	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+#endif
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -426,6 +645,197 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Run queue operations. The caller holds the cpu's runqueue lock.
+ *
+ * With OPT_A2 there is a queue per priority level (see schedule()): a
+ * thread goes on the queue for its t_level, and the next to run is
+ * the head of the highest-priority queue that isn't empty.
+ */
+
+/*
+ * Number of threads ready to run on C. With OPT_A2 this may also be
+ * called without the lock, for a snapshot that may already be out of
+ * date.
+ */
+static
+unsigned
+runqueue_count(struct cpu *c)
+{
+#ifdef OPT_A2
+	return c->c_runcount;
+#else
+	return c->c_runqueue.tl_count;
+#endif
+}
+
+/* Queue T on C, behind everything else of its priority. */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+#ifdef OPT_A2
+	KASSERT(t->t_level < SCHED_NLEVELS);
+	threadlist_addtail(&c->c_runqueue[t->t_level], t);
+	c->c_runcount++;
+#else
+	threadlist_addtail(&c->c_runqueue, t);
+#endif
+}
+
+/* Take the thread that should run next on C, or NULL if there is none. */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+#ifdef OPT_A2
+	struct thread *t;
+	unsigned i;
+
+	for (i = 0; i < SCHED_NLEVELS; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+#else
+	return threadlist_remhead(&c->c_runqueue);
+#endif
+}
+
+/* Take the thread that would run last on C, or NULL if there is none. */
+static
+struct thread *
+runqueue_remtail(struct cpu *c)
+{
+#ifdef OPT_A2
+	struct thread *t;
+	unsigned i;
+
+	for (i = SCHED_NLEVELS; i-- > 0; ) {
+		t = threadlist_remtail(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+#else
+	return threadlist_remtail(&c->c_runqueue);
+#endif
+}
+
+#ifdef OPT_A2
+/*
+ * Load balancing. Rather than wait for thread_consider_migration to
+ * push work over, a cpu with nothing to run steals a thread from the
+ * busiest other cpu before idling, and new threads start on the least
+ * busy cpu. Both choose by the lock-free c_runcount snapshots, so
+ * looking costs no locks, only taking does.
+ */
+
+/*
+ * Take a thread from another cpu's run queue for this one to run, or
+ * return NULL if nobody has one to spare. The caller must not hold
+ * its own runqueue lock, since two cpus may be stealing from each
+ * other.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, n, most;
+
+	victim = NULL;
+	most = 0;
+	for (i = 0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		n = runqueue_count(c);
+		if (c != curcpu->c_self && n > most) {
+			victim = c;
+			most = n;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	/* The last to run there: the lowest priority, and the coldest */
+	spinlock_acquire(&victim->c_runqueue_lock);
+	t = runqueue_remtail(victim);
+	if (t == victim->c_curthread) {
+		/*
+		 * It went to sleep, the victim went idle on its stack,
+		 * and it was woken before the victim got going again
+		 * (see thread_consider_migration). Leave it be.
+		 */
+		runqueue_add(victim, t);
+		t = NULL;
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (t != NULL) {
+		t->t_cpu = curcpu->c_self;
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u\n",
+		      t->t_name, victim->c_number, curcpu->c_number);
+	}
+	return t;
+}
+
+/*
+ * Wake up an idle cpu other than this one and BUSY, if there is one,
+ * so it can steal something. It's only a hint, so no locks.
+ */
+static
+void
+thread_kickidle(struct cpu *busy)
+{
+	struct cpu *c;
+	unsigned i;
+
+	for (i = 0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != busy && c != curcpu->c_self && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
+/*
+ * Choose a cpu for a new thread: an idle one if there is one, and
+ * otherwise the one with the fewest threads waiting. Ties go to the
+ * current cpu, which has the parent's cache.
+ */
+static
+struct cpu *
+thread_pickcpu(void)
+{
+	struct cpu *c, *best;
+	unsigned i, load, bestload;
+
+	best = curcpu->c_self;
+	bestload = runqueue_count(best) + 1;	/* counting ourselves */
+	for (i = 0; i < cpuarray_num(&allcpus) && bestload > 0; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		/* c_isidle is also just a hint without the lock */
+		load = runqueue_count(c) + (c->c_isidle ? 0 : 1);
+		if (load < bestload) {
+			best = c;
+			bestload = load;
+		}
+	}
+	return best;
+}
+#endif /* OPT_A2 */
+
 /*
  * Make a thread runnable.
  *
@@ -450,7 +860,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -458,6 +868,15 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+#ifdef OPT_A2
+	else {
+		/*
+		 * It has to wait its turn there. Idle cpus don't take
+		 * hardclocks to go looking for work, so tell one.
+		 */
+		thread_kickidle(targetcpu);
+	}
+#endif
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
@@ -487,6 +906,23 @@ thread_fork(const char *name,
 	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
 #endif // UW
 
+#ifdef OPT_A2
+	/* One that has exited, if there is one; it has a stack already */
+	newthread = thread_cache_get(name);
+	if (newthread == NULL) {
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
+	}
+	if (newthread->t_stack == NULL) {
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+	}
+#else
 	newthread = thread_create(name);
 	if (newthread == NULL) {
 		return ENOMEM;
@@ -498,6 +934,7 @@ thread_fork(const char *name,
 		thread_destroy(newthread);
 		return ENOMEM;
 	}
+#endif
 	thread_checkstack_init(newthread);
 
 	/*
@@ -505,7 +942,11 @@ thread_fork(const char *name,
 	 */
 
 	/* Thread subsystem fields */
+#ifdef OPT_A2
+	newthread->t_cpu = thread_pickcpu();
+#else
 	newthread->t_cpu = curthread->t_cpu;
+#endif
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -574,7 +1015,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && runqueue_count(curcpu) == 0) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -603,7 +1044,24 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		 * without racing. Exercise: what's the other?)
 		 */
 		threadlist_addtail(&wc->wc_threads, cur);
+#ifdef OPT_A2
+		cur->t_wchan = wc;
+#endif
 		wchan_unlock(wc);
+#ifdef OPT_A2
+		/*
+		 * Blocking well before its quantum ran out looks
+		 * interactive, so move up a level. Otherwise keep
+		 * what it has used, so a CPU hog can't dodge being
+		 * moved down by sleeping just in time.
+		 */
+		if (cur->t_ticks < SCHED_QUANTUM(curcpu, cur->t_level) / 2) {
+			if (cur->t_level > 0) {
+				cur->t_level--;
+			}
+			cur->t_ticks = 0;
+		}
+#endif
 		break;
 	    case S_ZOMBIE:
 		cur->t_wchan_name = "ZOMBIE";
@@ -632,14 +1090,31 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
+#ifdef OPT_A2
+			/* Look for work elsewhere before going to sleep */
+			next = thread_steal();
+			if (next == NULL) {
+				/* No hardclocks needed until there's work */
+				if (!curcpu->c_idleclock) {
+					mainbus_idleclock(true);
+				}
+				cpu_idle();
+			}
+#else
 			cpu_idle();
+#endif
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
+#ifdef OPT_A2
+	if (curcpu->c_idleclock) {
+		mainbus_idleclock(false);
+	}
+#endif
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -824,8 +1299,131 @@ thread_yield(void)
  *
  * This is called periodically from hardclock(). It should reshuffle
  * the current CPU's run queue by job priority.
+ *
+ * With OPT_A2 this is a multi-level feedback queue. Each cpu has a
+ * run queue for each of SCHED_NLEVELS priority levels, and always
+ * runs the first thread of the highest level that has one. A thread
+ * at level L runs for SCHED_QUANTUM(L) hardclocks at a time, longer
+ * further down. A thread that uses up its whole quantum is a CPU hog
+ * and moves down a level (thread_tick); one that blocks early is
+ * interactive and moves up a level (thread_switch). A thread is
+ * preempted as soon as something of a higher level is ready, so
+ * interactive threads that wake up get the cpu within a hardclock.
+ *
+ * So hogs at the bottom aren't starved forever, and threads that
+ * have changed their ways get another chance, everything here is
+ * moved back to the top every SCHED_BOOST_HARDCLOCKS.
  */
 
+#ifdef OPT_A2
+void
+schedule(void)
+{
+	struct thread *t;
+	unsigned i, n;
+
+	if (curcpu->c_hardclocks % SCHED_BOOST_HARDCLOCKS != 0) {
+		return;
+	}
+
+	/* Level 0 goes round once in order; the rest join it behind */
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i = 0; i < SCHED_NLEVELS; i++) {
+		n = curcpu->c_runqueue[i].tl_count;
+		while (n-- > 0) {
+			t = threadlist_remhead(&curcpu->c_runqueue[i]);
+			t->t_level = 0;
+			t->t_ticks = 0;
+			threadlist_addtail(&curcpu->c_runqueue[0], t);
+		}
+	}
+	if (!curcpu->c_isidle) {
+		curthread->t_level = 0;
+		curthread->t_ticks = 0;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+void
+thread_tick(void)
+{
+	struct thread *cur = curthread;
+	bool preempt;
+	unsigned i;
+
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	cur->t_ticks++;
+	if (cur->t_ticks >= SCHED_QUANTUM(curcpu, cur->t_level)) {
+		/* Used up its quantum: down a level, and let others run */
+		if (cur->t_level < SCHED_NLEVELS - 1) {
+			cur->t_level++;
+		}
+		cur->t_ticks = 0;
+		/* If there are any; a switch to ourselves is just overhead */
+		if (runqueue_count(curcpu) > 0) {
+			thread_yield();
+		}
+		return;
+	}
+
+	/* Otherwise it keeps the cpu unless something more important is ready */
+	if (runqueue_count(curcpu) == 0) {
+		return;
+	}
+	preempt = false;
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i = 0; i < cur->t_level; i++) {
+		if (!threadlist_isempty(&curcpu->c_runqueue[i])) {
+			preempt = true;
+			break;
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (preempt) {
+		thread_yield();
+	}
+}
+
+int
+thread_setquantum(int cpunum, unsigned hardclocks)
+{
+	unsigned i;
+
+	if (hardclocks == 0 || hardclocks > SCHED_MAX_QUANTUM) {
+		return EINVAL;
+	}
+	if (cpunum >= 0) {
+		if ((unsigned)cpunum >= cpuarray_num(&allcpus)) {
+			return EINVAL;
+		}
+		/* A single word; the cpu picks it up at its next hardclock */
+		cpuarray_get(&allcpus, cpunum)->c_quantum = hardclocks;
+		return 0;
+	}
+	for (i = 0; i < cpuarray_num(&allcpus); i++) {
+		cpuarray_get(&allcpus, i)->c_quantum = hardclocks;
+	}
+	return 0;
+}
+
+void
+thread_printquanta(void)
+{
+	struct cpu *c;
+	unsigned i;
+
+	for (i = 0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("cpu%u: quantum %u hardclock%s (%u ms at level 0)\n",
+			c->c_number, c->c_quantum,
+			c->c_quantum == 1 ? "" : "s", c->c_quantum * 1000 / HZ);
+	}
+}
+#else
 void
 schedule(void)
 {
@@ -834,6 +1432,7 @@ schedule(void)
 	 * round-robin fashion.
 	 */
 }
+#endif /* OPT_A2 */
 
 /*
  * Thread migration.
@@ -865,12 +1464,20 @@ thread_consider_migration(void)
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
+#ifdef OPT_A2
+		/* The counts are only a guide anyway; see below */
+		total_count += runqueue_count(c);
+		if (c == curcpu->c_self) {
+			my_count = runqueue_count(c);
+		}
+#else
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		total_count += runqueue_count(c);
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = runqueue_count(c);
 		}
 		spinlock_release(&c->c_runqueue_lock);
+#endif
 	}
 
 	one_share = DIVROUNDUP(total_count, numcpus);
@@ -882,7 +1489,12 @@ thread_consider_migration(void)
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		t = runqueue_remtail(curcpu);
+		if (t == NULL) {
+			/* taken by a thief since we counted */
+			to_send = i;
+			break;
+		}
 		threadlist_addhead(&victims, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -893,7 +1505,7 @@ thread_consider_migration(void)
 			continue;
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		while (runqueue_count(c) < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
 			 * Ordinarily, curthread will not appear on
@@ -924,7 +1536,7 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -948,7 +1560,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(curcpu, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1028,6 +1640,66 @@ wchan_sleep(struct wchan *wc)
 	thread_switch(S_SLEEP, wc);
 }
 
+#ifdef OPT_A2
+/* A thread in wchan_sleep_timeout, for its callout */
+struct wchan_timeout {
+	struct callout wt_callout;
+	struct thread *wt_thread;
+	struct wchan *wt_wchan;
+	bool wt_timedout;
+};
+
+/*
+ * The callout: wake the thread, unless it has been woken already.
+ */
+static
+void
+wchan_timeout(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct wchan *wc = wt->wt_wchan;
+	struct thread *t = wt->wt_thread;
+	bool wake;
+
+	spinlock_acquire(&wc->wc_lock);
+	wake = (t->t_wchan == wc);
+	if (wake) {
+		threadlist_remove(&wc->wc_threads, t);
+		t->t_wchan = NULL;
+		wt->wt_timedout = true;
+	}
+	spinlock_release(&wc->wc_lock);
+
+	if (wake) {
+		thread_make_runnable(t, false);
+	}
+}
+
+int
+wchan_sleep_timeout(struct wchan *wc, unsigned usec)
+{
+	struct wchan_timeout wt;
+
+	/* may not sleep in an interrupt handler */
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(spinlock_do_i_hold(&wc->wc_lock));
+
+	wt.wt_thread = curthread;
+	wt.wt_wchan = wc;
+	wt.wt_timedout = false;
+	callout_init(&wt.wt_callout);
+
+	/* If it goes off before we're asleep, it waits for the channel lock */
+	callout_schedule(&wt.wt_callout, wchan_timeout, &wt, usec);
+	thread_switch(S_SLEEP, wc);
+
+	/* wt is on our stack, so make sure the callout is done with it */
+	callout_cancel(&wt.wt_callout);
+
+	return wt.wt_timedout ? ETIMEDOUT : 0;
+}
+#endif /* OPT_A2 */
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1039,6 +1711,11 @@ wchan_wakeone(struct wchan *wc)
 	/* Lock the channel and grab a thread from it */
 	spinlock_acquire(&wc->wc_lock);
 	target = threadlist_remhead(&wc->wc_threads);
+#ifdef OPT_A2
+	if (target != NULL) {
+		target->t_wchan = NULL;
+	}
+#endif
 	/*
 	 * Nobody else can wake up this thread now, so we don't need
 	 * to hang onto the lock.
@@ -1070,6 +1747,9 @@ wchan_wakeall(struct wchan *wc)
 	 */
 	spinlock_acquire(&wc->wc_lock);
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+#ifdef OPT_A2
+		target->t_wchan = NULL;
+#endif
 		threadlist_addtail(&list, target);
 	}
 	/*
@@ -1162,6 +1842,25 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+#if OPT_A3
+unsigned
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	unsigned i, n;
+	struct cpu *c;
+
+	n = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, mapping);
+			n++;
+		}
+	}
+	return n;
+}
+#endif
+
 void
 interprocessor_interrupt(void)
 {
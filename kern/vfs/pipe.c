@@ -0,0 +1,735 @@
+/*
+ * Anonymous pipes. See pipe.h.
+ *
+ * The buffer is a ring of PIPE_SIZE bytes with two free-running
+ * counters: p_head counts bytes ever written and is only changed by
+ * the writer, p_tail counts bytes ever read and is only changed by the
+ * reader. So with one reader and one writer neither needs a lock to
+ * move data: the writer fills the space between head and tail+SIZE and
+ * then publishes the new head, the reader empties the space between
+ * tail and head and then publishes the new tail.
+ *
+ * Sleeping is the only thing that needs care. A reader that finds the
+ * buffer empty sets p_readwaiting under the wait channel's lock and
+ * checks again before sleeping; the writer, having published its new
+ * head, only touches the wait channel if p_readwaiting is set. Since
+ * one side sets its flag and then reads the counter, and the other
+ * writes the counter and then reads the flag, at least one of them
+ * sees the other, and a wakeup can't be lost. The writer does the same
+ * when the buffer is full. This means a wakeup is only ever sent when
+ * the other side has actually gone to sleep on an empty or full
+ * buffer, not once per read or write.
+ *
+ * (This relies on the CPUs seeing each other's stores in order, which
+ * is true on System/161.)
+ *
+ * Big writes don't go through the ring at all (A3 only). A write of
+ * whole, page-aligned user pages lends each page to the pipe instead:
+ * the writer's mapping becomes copy-on-write, as after fork, and the
+ * pipe queues the frame in p_loans. A page-aligned read of a whole
+ * lent page maps the frame straight into the reader, copy-on-write
+ * again, so the data is never copied at all unless one side writes to
+ * it afterwards. Anything less tidy on the reading side is copied out
+ * of the lent frame. Lent pages sit in the stream between the ring's
+ * bytes: p_head and p_tail count both, the ring has its own p_bhead
+ * and p_btail, and each loan records the stream position it starts at.
+ *
+ * If more than one process has the same end open, they take turns:
+ * each read or write claims its end for as long as it runs, so writes
+ * don't interleave. In the usual one-reader, one-writer case the claim
+ * is never contended and costs a spinlock.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <kern/stattypes.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <uio.h>
+#include <vm.h>
+#include <vnode.h>
+#include <pipe.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <addrspace.h>
+#include <coremap.h>
+#endif /* OPT_A3 */
+
+#define PIPE_SIZE PAGE_SIZE	/* ring size; must be a power of 2 */
+#define PIPE_LOANS 16		/* most pages that can be lent at once */
+
+struct pipe_loan {
+	paddr_t pl_paddr;		/* the lent frame; the pipe holds a reference */
+	unsigned pl_start;		/* stream position of its first byte */
+};
+
+struct pipe {
+	volatile unsigned p_head;	/* bytes ever written */
+	volatile unsigned p_tail;	/* bytes ever read */
+
+	char *p_buf;
+	volatile unsigned p_bhead;	/* bytes ever written to the ring */
+	volatile unsigned p_btail;	/* bytes ever read from the ring */
+
+	struct pipe_loan p_loans[PIPE_LOANS];
+	volatile unsigned p_lhead;	/* pages ever lent */
+	volatile unsigned p_ltail;	/* lent pages ever used up */
+
+	/* Set by a reader or writer just before it sleeps */
+	volatile bool p_readwaiting;
+	volatile bool p_writewaiting;
+	struct wchan *p_readwc;		/* reader waiting for data */
+	struct wchan *p_writewc;	/* writer waiting for room */
+
+	/* Claims on each end, protected by the claim channel's lock */
+	bool p_readbusy;
+	bool p_writebusy;
+	struct wchan *p_readclaimwc;
+	struct wchan *p_writeclaimwc;
+
+	struct spinlock p_lock;		/* for closing */
+	volatile bool p_readclosed;
+	volatile bool p_writeclosed;
+
+	struct vnode p_readvn;
+	struct vnode p_writevn;
+};
+
+static const struct vnode_ops pipe_vnode_ops;
+
+/*
+ * Wait until nobody else is using this end of the pipe, then mark it
+ * in use.
+ */
+static
+void
+pipe_claim(struct wchan *wc, bool *busy)
+{
+	wchan_lock(wc);
+	while (*busy) {
+		wchan_sleep(wc);
+		wchan_lock(wc);
+	}
+	*busy = true;
+	wchan_unlock(wc);
+}
+
+static
+void
+pipe_unclaim(struct wchan *wc, bool *busy)
+{
+	wchan_lock(wc);
+	*busy = false;
+	wchan_unlock(wc);
+	wchan_wakeone(wc);
+}
+
+/* Wake the other side, but only if it's asleep. */
+static
+void
+pipe_wake(struct wchan *wc, volatile bool *waiting)
+{
+	if (*waiting) {
+		*waiting = false;
+		wchan_wakeall(wc);
+	}
+}
+
+#if OPT_A3
+
+/* Is the rest of UIO whole pages of user memory, page-aligned? */
+static
+bool
+pipe_pageable(struct uio *uio)
+{
+	vaddr_t va = (vaddr_t)uio->uio_iov->iov_ubase;
+
+	return uio->uio_segflg == UIO_USERSPACE && uio->uio_iovcnt == 1 &&
+		uio->uio_iov->iov_len >= PAGE_SIZE && (va & PAGE_FRAME) == va;
+}
+
+/* Move UIO along by a page that was mapped rather than copied. */
+static
+void
+pipe_skippage(struct uio *uio)
+{
+	uio->uio_iov->iov_ubase += PAGE_SIZE;
+	uio->uio_iov->iov_len -= PAGE_SIZE;
+	uio->uio_resid -= PAGE_SIZE;
+	uio->uio_offset += PAGE_SIZE;
+}
+
+/*
+ * Read from the lent page PL, starting OFF bytes in. Maps the whole
+ * page into the reader if it can, and copies otherwise. Returns the
+ * number of bytes read in *N; once the page is used up the pipe's
+ * reference to it is gone.
+ */
+static
+int
+pipe_readloan(struct pipe_loan *pl, unsigned off, struct uio *uio,
+	      unsigned *n)
+{
+	int result;
+
+	if (off == 0 && pipe_pageable(uio) &&
+	    as_mappage(uio->uio_space, (vaddr_t)uio->uio_iov->iov_ubase,
+		       pl->pl_paddr) == 0) {
+		/* The reader has our reference now */
+		pipe_skippage(uio);
+		*n = PAGE_SIZE;
+		return 0;
+	}
+
+	*n = PAGE_SIZE - off;
+	if (*n > uio->uio_resid) {
+		*n = uio->uio_resid;
+	}
+	result = uiomove((char *)PADDR_TO_KVADDR(pl->pl_paddr) + off, *n, uio);
+	if (result) {
+		return result;
+	}
+	if (off + *n == PAGE_SIZE) {
+		coremap_decref(pl->pl_paddr);
+	}
+	return 0;
+}
+
+#endif /* OPT_A3 */
+
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	unsigned head, tail, btail, off, n, limit;
+	int result = 0;
+#if OPT_A3
+	struct pipe_loan *pl;
+	unsigned ltail;
+#endif
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	if (v != &p->p_readvn) {
+		return EBADF;
+	}
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
+
+	pipe_claim(p->p_readclaimwc, &p->p_readbusy);
+
+	/* Wait for something to read, or for there never to be anything */
+	tail = p->p_tail;
+	while ((head = p->p_head) == tail) {
+		if (p->p_writeclosed) {
+			pipe_unclaim(p->p_readclaimwc, &p->p_readbusy);
+			return 0;
+		}
+		wchan_lock(p->p_readwc);
+		p->p_readwaiting = true;
+		if (p->p_head == tail && !p->p_writeclosed) {
+			wchan_sleep(p->p_readwc);
+		}
+		else {
+			p->p_readwaiting = false;
+			wchan_unlock(p->p_readwc);
+		}
+	}
+
+	btail = p->p_btail;
+#if OPT_A3
+	ltail = p->p_ltail;
+#endif
+
+	while (tail != head && uio->uio_resid > 0) {
+		limit = head - tail;
+
+#if OPT_A3
+		if (ltail != p->p_lhead) {
+			pl = &p->p_loans[ltail % PIPE_LOANS];
+			off = tail - pl->pl_start;
+			if (off < PAGE_SIZE) {
+				/* In a lent page */
+				result = pipe_readloan(pl, off, uio, &n);
+				if (result) {
+					break;
+				}
+				tail += n;
+				if (off + n == PAGE_SIZE) {
+					ltail++;
+				}
+				continue;
+			}
+			/* Only the ring's bytes from before the next lent page */
+			if (pl->pl_start - tail < limit) {
+				limit = pl->pl_start - tail;
+			}
+		}
+#endif
+
+		/* Take as much as there is room for; at most two pieces if it wraps */
+		off = btail % PIPE_SIZE;
+		n = limit;
+		if (n > PIPE_SIZE - off) {
+			n = PIPE_SIZE - off;
+		}
+		if (n > uio->uio_resid) {
+			n = uio->uio_resid;
+		}
+		result = uiomove(p->p_buf + off, n, uio);
+		if (result) {
+			break;
+		}
+		btail += n;
+		tail += n;
+	}
+
+	p->p_btail = btail;
+#if OPT_A3
+	p->p_ltail = ltail;
+#endif
+	p->p_tail = tail;
+	pipe_wake(p->p_writewc, &p->p_writewaiting);
+
+	pipe_unclaim(p->p_readclaimwc, &p->p_readbusy);
+	return result;
+}
+
+/*
+ * Wait for the reader to take something, having found the pipe full
+ * when p_tail was TAIL.
+ */
+static
+void
+pipe_writewait(struct pipe *p, unsigned tail)
+{
+	wchan_lock(p->p_writewc);
+	p->p_writewaiting = true;
+	if (p->p_tail == tail && !p->p_readclosed) {
+		wchan_sleep(p->p_writewc);
+	}
+	else {
+		p->p_writewaiting = false;
+		wchan_unlock(p->p_writewc);
+	}
+}
+
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	unsigned head, tail, bhead, off, n;
+	int result = 0;
+#if OPT_A3
+	struct pipe_loan *pl;
+	unsigned lhead;
+	paddr_t paddr;
+#endif
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+
+	if (v != &p->p_writevn) {
+		return EBADF;
+	}
+
+	pipe_claim(p->p_writeclaimwc, &p->p_writebusy);
+
+	head = p->p_head;
+	bhead = p->p_bhead;
+#if OPT_A3
+	lhead = p->p_lhead;
+#endif
+	while (uio->uio_resid > 0) {
+		if (p->p_readclosed) {
+			result = EPIPE;
+			break;
+		}
+
+		/* Whatever the reader takes moves p_tail, so wait on that */
+		tail = p->p_tail;
+
+#if OPT_A3
+		if (pipe_pageable(uio)) {
+			if (lhead - p->p_ltail == PIPE_LOANS) {
+				pipe_writewait(p, tail);
+				continue;
+			}
+			if (as_lendpage(uio->uio_space,
+					(vaddr_t)uio->uio_iov->iov_ubase,
+					&paddr) == 0) {
+				pl = &p->p_loans[lhead % PIPE_LOANS];
+				pl->pl_paddr = paddr;
+				pl->pl_start = head;
+				pipe_skippage(uio);
+				lhead++;
+				head += PAGE_SIZE;
+
+				p->p_lhead = lhead;
+				p->p_head = head;
+				pipe_wake(p->p_readwc, &p->p_readwaiting);
+				continue;
+			}
+			/* Not in memory; copy it like anything else */
+		}
+#endif
+
+		if (bhead - p->p_btail == PIPE_SIZE) {
+			pipe_writewait(p, tail);
+			continue;
+		}
+
+		off = bhead % PIPE_SIZE;
+		n = PIPE_SIZE - (bhead - p->p_btail);
+		if (n > PIPE_SIZE - off) {
+			n = PIPE_SIZE - off;
+		}
+		if (n > uio->uio_resid) {
+			n = uio->uio_resid;
+		}
+		result = uiomove(p->p_buf + off, n, uio);
+		if (result) {
+			break;
+		}
+		bhead += n;
+		head += n;
+
+		p->p_bhead = bhead;
+		p->p_head = head;
+		pipe_wake(p->p_readwc, &p->p_readwaiting);
+	}
+
+	pipe_unclaim(p->p_writeclaimwc, &p->p_writebusy);
+	return result;
+}
+
+static
+void
+pipe_destroy(struct pipe *p)
+{
+#if OPT_A3
+	unsigned i;
+
+	/* Lent pages nobody read */
+	for (i = p->p_ltail; i != p->p_lhead; i++) {
+		coremap_decref(p->p_loans[i % PIPE_LOANS].pl_paddr);
+	}
+#endif
+
+	wchan_destroy(p->p_readwc);
+	wchan_destroy(p->p_writewc);
+	wchan_destroy(p->p_readclaimwc);
+	wchan_destroy(p->p_writeclaimwc);
+	spinlock_cleanup(&p->p_lock);
+	kfree(p->p_buf);
+	kfree(p);
+}
+
+int
+pipe_create(struct vnode **readend, struct vnode **writeend)
+{
+	struct pipe *p;
+
+	p = kmalloc(sizeof(struct pipe));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->p_buf = kmalloc(PIPE_SIZE);
+	p->p_readwc = wchan_create("pipe read");
+	p->p_writewc = wchan_create("pipe write");
+	p->p_readclaimwc = wchan_create("pipe read claim");
+	p->p_writeclaimwc = wchan_create("pipe write claim");
+	if (p->p_buf == NULL || p->p_readwc == NULL || p->p_writewc == NULL ||
+	    p->p_readclaimwc == NULL || p->p_writeclaimwc == NULL) {
+		if (p->p_readwc) wchan_destroy(p->p_readwc);
+		if (p->p_writewc) wchan_destroy(p->p_writewc);
+		if (p->p_readclaimwc) wchan_destroy(p->p_readclaimwc);
+		if (p->p_writeclaimwc) wchan_destroy(p->p_writeclaimwc);
+		kfree(p->p_buf);
+		kfree(p);
+		return ENOMEM;
+	}
+
+	p->p_head = 0;
+	p->p_tail = 0;
+	p->p_bhead = 0;
+	p->p_btail = 0;
+	p->p_lhead = 0;
+	p->p_ltail = 0;
+	p->p_readwaiting = false;
+	p->p_writewaiting = false;
+	p->p_readbusy = false;
+	p->p_writebusy = false;
+	spinlock_init(&p->p_lock);
+	p->p_readclosed = false;
+	p->p_writeclosed = false;
+
+	VOP_INIT(&p->p_readvn, &pipe_vnode_ops, NULL, p);
+	VOP_INIT(&p->p_writevn, &pipe_vnode_ops, NULL, p);
+
+	/* As if vfs_open had opened them, so vfs_close closes them */
+	VOP_INCOPEN(&p->p_readvn);
+	VOP_INCOPEN(&p->p_writevn);
+
+	*readend = &p->p_readvn;
+	*writeend = &p->p_writevn;
+	return 0;
+}
+
+bool
+pipe_isend(struct vnode *v)
+{
+	return v->vn_ops == &pipe_vnode_ops;
+}
+
+/*
+ * Called when the last reference to one end goes away. The pipe goes
+ * away with the second end.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+	bool last;
+
+	VOP_CLEANUP(v);
+
+	/* Wake the other end under p_lock so it can't be freed under us */
+	spinlock_acquire(&p->p_lock);
+	if (v == &p->p_readvn) {
+		p->p_readclosed = true;
+		p->p_writewaiting = false;
+		wchan_wakeall(p->p_writewc);
+	}
+	else {
+		p->p_writeclosed = true;
+		p->p_readwaiting = false;
+		wchan_wakeall(p->p_readwc);
+	}
+	last = p->p_readclosed && p->p_writeclosed;
+	spinlock_release(&p->p_lock);
+
+	if (last) {
+		pipe_destroy(p);
+	}
+	return 0;
+}
+
+static
+int
+pipe_open(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return 0;
+}
+
+static
+int
+pipe_close(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *p = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = _S_IFIFO;
+	statbuf->st_size = p->p_head - p->p_tail;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = PIPE_SIZE;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *result)
+{
+	(void)v;
+	*result = _S_IFIFO;
+	return 0;
+}
+
+static
+int
+pipe_tryseek(struct vnode *v, off_t pos)
+{
+	(void)v;
+	(void)pos;
+	return ESPIPE;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+/*
+ * Everything else a pipe can't do.
+ */
+
+static
+int
+pipe_badio(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return EINVAL;
+}
+
+static
+int
+pipe_mmap(struct vnode *v)
+{
+	(void)v;
+	return EUNIMP;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static
+int
+pipe_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	   struct vnode **result)
+{
+	(void)v;
+	(void)name;
+	(void)excl;
+	(void)mode;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	(void)v;
+	(void)contents;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	(void)v;
+	(void)name;
+	(void)mode;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	(void)v;
+	(void)name;
+	(void)file;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_nameop(struct vnode *v, const char *name)
+{
+	(void)v;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_rename(struct vnode *v1, const char *n1, struct vnode *v2, const char *n2)
+{
+	(void)v1;
+	(void)n1;
+	(void)v2;
+	(void)n2;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookup(struct vnode *dir, char *pathname, struct vnode **result)
+{
+	(void)dir;
+	(void)pathname;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookparent(struct vnode *dir, char *pathname, struct vnode **result,
+		char *namebuf, size_t buflen)
+{
+	(void)dir;
+	(void)pathname;
+	(void)result;
+	(void)namebuf;
+	(void)buflen;
+	return ENOTDIR;
+}
+
+/*
+ * Function table for pipe vnodes.
+ */
+static const struct vnode_ops pipe_vnode_ops = {
+	VOP_MAGIC,
+
+	pipe_open,
+	pipe_close,
+	pipe_reclaim,
+	pipe_read,
+	pipe_badio,	/* readlink */
+	pipe_badio,	/* getdirentry */
+	pipe_write,
+	pipe_ioctl,
+	pipe_stat,
+	pipe_gettype,
+	pipe_tryseek,
+	pipe_fsync,
+	pipe_mmap,
+	pipe_truncate,
+	pipe_badio,	/* namefile */
+	pipe_creat,
+	pipe_symlink,
+	pipe_mkdir,
+	pipe_link,
+	pipe_nameop,	/* remove */
+	pipe_nameop,	/* rmdir */
+	pipe_rename,
+	pipe_lookup,
+	pipe_lookparent,
+};
@@ -0,0 +1,489 @@
+/*
+ * Physical page frame allocator.
+ *
+ * The coremap itself lives in the first few frames of the memory that
+ * ram_getsize() reports; every frame after that is described by one
+ * struct coremap_entry. All fields are protected by coremap_lock.
+ *
+ * Single frames (the common case, both for user pages and for the
+ * kmalloc subpage allocator) are found by scanning forward from where
+ * the last search stopped, so a steady state of allocs and frees does
+ * not keep rescanning the low end of memory. Multi-page kernel blocks
+ * use first fit.
+ *
+ * User frames carry a reference count, one per page table that maps
+ * them, so copy-on-write sharing after fork can hand the same frame
+ * to several address spaces. The count going back down to 1 doesn't
+ * say who is left, so a frame stays without an owner until the one
+ * remaining address space faults on it again.
+ *
+ * When memory runs out the VM system pages out the frame the clock
+ * hand stops on: it sweeps over the owned user frames, clearing the
+ * referenced bit that vm_fault sets, and takes the first one it finds
+ * already clear. Since the bit is only set on TLB misses it is a rough
+ * guess at recent use, but a frame that keeps getting faulted back in
+ * survives a full sweep.
+ *
+ * The page cache is a hash table over the coremap entries themselves,
+ * chained through cme_cachenext.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <coremap.h>
+
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+static struct coremap_entry *coremap;	/* one entry per managed frame */
+static paddr_t coremap_base;		/* physical address of frame 0 */
+static unsigned coremap_npages;		/* number of managed frames */
+static unsigned coremap_nfree;		/* number of CM_FREE frames */
+static unsigned coremap_hint;		/* where to start the next 1-page search */
+static unsigned coremap_clock;		/* where the eviction clock hand is */
+static bool coremap_ready = false;
+
+#define CM_PADDR(i)   (coremap_base + (paddr_t)(i) * PAGE_SIZE)
+#define CM_INDEX(pa)  (((pa) - coremap_base) / PAGE_SIZE)
+
+/* Page cache buckets; each holds a coremap index plus 1, or 0 if empty */
+#define CM_CACHEBUCKETS 64
+static unsigned coremap_cache[CM_CACHEBUCKETS];
+
+#define CM_CACHEHASH(v, va) \
+	((((uintptr_t)(v) >> 4) ^ ((va) >> 12)) % CM_CACHEBUCKETS)
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t lo, hi;
+	unsigned npages, cmpages, i;
+
+	ram_getsize(&lo, &hi);
+	KASSERT((lo & PAGE_FRAME) == lo);
+	KASSERT((hi & PAGE_FRAME) == hi);
+
+	npages = (hi - lo) / PAGE_SIZE;
+
+	/* The coremap is sized for all of memory, including its own pages. */
+	cmpages = DIVROUNDUP(npages * sizeof(struct coremap_entry), PAGE_SIZE);
+	if (cmpages >= npages) {
+		panic("coremap: not enough memory for the coremap\n");
+	}
+
+	coremap = (struct coremap_entry *) PADDR_TO_KVADDR(lo);
+	coremap_base = lo + cmpages * PAGE_SIZE;
+	coremap_npages = npages - cmpages;
+
+	for (i = 0; i < coremap_npages; i++) {
+		coremap[i].cme_state = CM_FREE;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_referenced = false;
+		coremap[i].cme_vnode = NULL;
+		coremap[i].cme_cachenext = 0;
+	}
+	for (i = 0; i < CM_CACHEBUCKETS; i++) {
+		coremap_cache[i] = 0;
+	}
+
+	coremap_nfree = coremap_npages;
+	coremap_hint = 0;
+	coremap_clock = 0;
+	coremap_ready = true;
+
+	DEBUG(DB_VM, "coremap: managing %u frames at 0x%x (%u frames of coremap)\n",
+	      coremap_npages, coremap_base, cmpages);
+}
+
+bool
+coremap_isready(void)
+{
+	return coremap_ready;
+}
+
+/*
+ * Find NPAGES free frames in a row. Returns the index of the first
+ * one, or -1 if there is no such run. Call with coremap_lock held.
+ */
+static
+int
+coremap_find(unsigned npages)
+{
+	unsigned i, j, run;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	if (npages == 0 || npages > coremap_nfree) {
+		return -1;
+	}
+
+	if (npages == 1) {
+		for (j = 0; j < coremap_npages; j++) {
+			i = (coremap_hint + j) % coremap_npages;
+			if (coremap[i].cme_state == CM_FREE) {
+				coremap_hint = (i + 1) % coremap_npages;
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	run = 0;
+	for (i = 0; i < coremap_npages; i++) {
+		if (coremap[i].cme_state != CM_FREE) {
+			run = 0;
+			continue;
+		}
+		if (++run == npages) {
+			return i + 1 - npages;
+		}
+	}
+	return -1;
+}
+
+paddr_t
+coremap_alloc_kpages(unsigned npages)
+{
+	int start;
+	unsigned i;
+
+	spinlock_acquire(&coremap_lock);
+
+	start = coremap_find(npages);
+	if (start < 0) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	for (i = start; i < start + npages; i++) {
+		coremap[i].cme_state = CM_KERNEL;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+	}
+	/* Remember the block length so free_kpages can give it all back */
+	coremap[start].cme_npages = npages;
+	coremap_nfree -= npages;
+
+	spinlock_release(&coremap_lock);
+
+	return CM_PADDR(start);
+}
+
+paddr_t
+coremap_alloc_upage(void)
+{
+	int i;
+
+	spinlock_acquire(&coremap_lock);
+
+	i = coremap_find(1);
+	if (i < 0) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	coremap[i].cme_state = CM_USER;
+	coremap[i].cme_npages = 1;
+	coremap[i].cme_refcount = 1;
+	coremap[i].cme_as = NULL;
+	coremap[i].cme_vaddr = 0;
+	coremap[i].cme_referenced = true;
+	coremap_nfree--;
+
+	spinlock_release(&coremap_lock);
+
+	return CM_PADDR(i);
+}
+
+/*
+ * Take the frame at IDX out of the page cache. Call with coremap_lock
+ * held.
+ */
+static
+void
+coremap_cache_remove(unsigned idx)
+{
+	unsigned *link;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(coremap[idx].cme_vnode != NULL);
+
+	link = &coremap_cache[CM_CACHEHASH(coremap[idx].cme_vnode,
+					   coremap[idx].cme_vaddr)];
+	while (*link != idx + 1) {
+		KASSERT(*link != 0);
+		link = &coremap[*link - 1].cme_cachenext;
+	}
+	*link = coremap[idx].cme_cachenext;
+
+	coremap[idx].cme_vnode = NULL;
+	coremap[idx].cme_cachenext = 0;
+}
+
+/*
+ * Put the block starting at IDX back in the free pool. Call with
+ * coremap_lock held.
+ */
+static
+void
+coremap_release(unsigned idx)
+{
+	unsigned i, npages;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(coremap[idx].cme_state != CM_FREE);
+
+	if (coremap[idx].cme_vnode != NULL) {
+		coremap_cache_remove(idx);
+	}
+
+	npages = coremap[idx].cme_npages;
+	KASSERT(npages > 0 && idx + npages <= coremap_npages);
+
+	for (i = idx; i < idx + npages; i++) {
+		coremap[i].cme_state = CM_FREE;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_referenced = false;
+	}
+	coremap_nfree += npages;
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	unsigned idx;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	/* Memory stolen before the coremap existed can't be given back. */
+	if (!coremap_ready || paddr < coremap_base) {
+		return;
+	}
+
+	idx = CM_INDEX(paddr);
+	KASSERT(idx < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[idx].cme_state == CM_KERNEL);
+	coremap_release(idx);
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Look up the coremap entry for a user frame. Call with coremap_lock
+ * held.
+ */
+static
+struct coremap_entry *
+coremap_user_entry(paddr_t paddr)
+{
+	unsigned idx;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	KASSERT(paddr >= coremap_base);
+
+	idx = CM_INDEX(paddr);
+	KASSERT(idx < coremap_npages);
+	KASSERT(coremap[idx].cme_state == CM_USER);
+	KASSERT(coremap[idx].cme_refcount > 0);
+
+	return &coremap[idx];
+}
+
+void
+coremap_incref(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_user_entry(paddr);
+	cme->cme_refcount++;
+	/* Shared now, so nobody in particular owns it */
+	cme->cme_as = NULL;
+	if (cme->cme_vnode == NULL) {
+		/* (A cached frame keeps its vaddr as part of the key) */
+		cme->cme_vaddr = 0;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_decref(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_user_entry(paddr);
+	cme->cme_refcount--;
+	if (cme->cme_refcount == 0) {
+		coremap_release(CM_INDEX(paddr));
+	}
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_refcount(paddr_t paddr)
+{
+	unsigned refcount;
+
+	spinlock_acquire(&coremap_lock);
+	refcount = coremap_user_entry(paddr)->cme_refcount;
+	spinlock_release(&coremap_lock);
+
+	return refcount;
+}
+
+void
+coremap_setowner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_user_entry(paddr);
+	KASSERT(cme->cme_refcount == 1);
+	cme->cme_as = as;
+	cme->cme_vaddr = vaddr;
+	spinlock_release(&coremap_lock);
+}
+
+/* Find a page in the cache. Call with coremap_lock held. */
+static
+int
+coremap_cache_find(struct vnode *v, vaddr_t vaddr)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	for (i = coremap_cache[CM_CACHEHASH(v, vaddr)]; i != 0;
+	     i = coremap[i - 1].cme_cachenext) {
+		if (coremap[i - 1].cme_vnode == v &&
+		    coremap[i - 1].cme_vaddr == vaddr) {
+			return i - 1;
+		}
+	}
+	return -1;
+}
+
+paddr_t
+coremap_cache_lookup(struct vnode *v, vaddr_t vaddr)
+{
+	int idx;
+
+	KASSERT(v != NULL);
+
+	spinlock_acquire(&coremap_lock);
+
+	idx = coremap_cache_find(v, vaddr);
+	if (idx < 0) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	KASSERT(coremap[idx].cme_state == CM_USER);
+	KASSERT(coremap[idx].cme_refcount > 0);
+	coremap[idx].cme_refcount++;
+	coremap[idx].cme_as = NULL;
+	coremap[idx].cme_referenced = true;
+
+	spinlock_release(&coremap_lock);
+
+	return CM_PADDR(idx);
+}
+
+paddr_t
+coremap_cache_insert(paddr_t paddr, struct vnode *v, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+	unsigned *bucket;
+	int idx;
+
+	KASSERT(v != NULL);
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	spinlock_acquire(&coremap_lock);
+
+	cme = coremap_user_entry(paddr);
+	KASSERT(cme->cme_refcount == 1);
+	KASSERT(cme->cme_vnode == NULL);
+
+	idx = coremap_cache_find(v, vaddr);
+	if (idx >= 0) {
+		/* Lost the race to load it; use theirs */
+		coremap_release(CM_INDEX(paddr));
+		coremap[idx].cme_refcount++;
+		coremap[idx].cme_as = NULL;
+		spinlock_release(&coremap_lock);
+		return CM_PADDR(idx);
+	}
+
+	cme->cme_vnode = v;
+	cme->cme_vaddr = vaddr;
+	bucket = &coremap_cache[CM_CACHEHASH(v, vaddr)];
+	cme->cme_cachenext = *bucket;
+	*bucket = CM_INDEX(paddr) + 1;
+
+	spinlock_release(&coremap_lock);
+
+	return paddr;
+}
+
+void
+coremap_touch(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_user_entry(paddr);
+	cme->cme_referenced = true;
+	if (cme->cme_refcount == 1 && cme->cme_as == NULL) {
+		/* Everyone it was shared with has let go; it's ours again */
+		KASSERT(cme->cme_vnode == NULL || cme->cme_vaddr == vaddr);
+		cme->cme_as = as;
+		cme->cme_vaddr = vaddr;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+paddr_t
+coremap_victim(struct addrspace **as, vaddr_t *vaddr)
+{
+	struct coremap_entry *cme;
+	unsigned i, idx;
+
+	spinlock_acquire(&coremap_lock);
+
+	/* Two trips round: the first may only be clearing referenced bits */
+	for (i = 0; i < 2 * coremap_npages; i++) {
+		idx = coremap_clock;
+		coremap_clock = (coremap_clock + 1) % coremap_npages;
+
+		cme = &coremap[idx];
+		if (cme->cme_state != CM_USER || cme->cme_as == NULL) {
+			continue;
+		}
+		if (cme->cme_referenced) {
+			cme->cme_referenced = false;
+			continue;
+		}
+
+		KASSERT(cme->cme_refcount == 1);
+		*as = cme->cme_as;
+		*vaddr = cme->cme_vaddr;
+		spinlock_release(&coremap_lock);
+		return CM_PADDR(idx);
+	}
+
+	spinlock_release(&coremap_lock);
+	return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Two-level page tables for user address spaces.
+ *
+ * Besides the process that owns it, a page table can be changed by
+ * whoever is evicting one of its pages, so callers hold vm_lock (see
+ * dumbvm.c). Allocating a second-level table can itself evict a page,
+ * which is why entries are reread after every pt_lookup that creates.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(struct pagetable));
+	if (pt == NULL) {
+		return NULL;
+	}
+
+	for (i = 0; i < PT_DIRENTRIES; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i, j;
+	pte_t *table;
+
+	KASSERT(pt != NULL);
+
+	for (i = 0; i < PT_DIRENTRIES; i++) {
+		table = pt->pt_dir[i];
+		if (table == NULL) {
+			continue;
+		}
+
+		for (j = 0; j < PT_ENTRIES; j++) {
+			if (table[j] & PTE_VALID) {
+				coremap_decref(table[j] & PTE_FRAME);
+			} else if (table[j] & PTE_SWAPPED) {
+				swap_free(PTE_SLOT(table[j]));
+			}
+		}
+
+		kfree(table);
+	}
+
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	pte_t *table;
+
+	KASSERT(pt != NULL);
+	KASSERT(vaddr < USERSPACETOP);
+
+	table = pt->pt_dir[PT_DIRINDEX(vaddr)];
+
+	if (table == NULL) {
+		if (!create) {
+			return NULL;
+		}
+
+		table = kmalloc(PT_ENTRIES * sizeof(pte_t));
+		if (table == NULL) {
+			return NULL;
+		}
+		bzero(table, PT_ENTRIES * sizeof(pte_t));
+
+		pt->pt_dir[PT_DIRINDEX(vaddr)] = table;
+	}
+
+	return &table[PT_INDEX(vaddr)];
+}
+
+int
+pt_copy(struct pagetable *old, struct pagetable *newpt)
+{
+	unsigned i, j, slot;
+	vaddr_t vaddr;
+	pte_t *pte;
+	int result;
+
+	for (i = 0; i < PT_DIRENTRIES; i++) {
+		if (old->pt_dir[i] == NULL) {
+			continue;
+		}
+
+		for (j = 0; j < PT_ENTRIES; j++) {
+			if ((old->pt_dir[i][j] & (PTE_VALID | PTE_SWAPPED)) == 0) {
+				continue;
+			}
+
+			vaddr = (i << 22) | (j << 12);
+
+			/* May page out the very page we're looking at */
+			pte = pt_lookup(newpt, vaddr, true);
+			if (pte == NULL) {
+				return ENOMEM;
+			}
+
+			/*
+			 * So look again. A read-only page may have been
+			 * dropped altogether; the child will fault it in from
+			 * the executable like the parent does.
+			 */
+			if ((old->pt_dir[i][j] & (PTE_VALID | PTE_SWAPPED)) == 0) {
+				continue;
+			}
+
+			if (old->pt_dir[i][j] & PTE_SWAPPED) {
+				/* Only resident frames can be shared */
+				result = swap_dup(PTE_SLOT(old->pt_dir[i][j]), &slot);
+				if (result) {
+					return result;
+				}
+				*pte = PTE_MKSWAPPED(slot);
+				continue;
+			}
+
+			/* Share the frame; whoever writes to it first gets a copy */
+			old->pt_dir[i][j] &= ~PTE_WRITE;
+			coremap_incref(old->pt_dir[i][j] & PTE_FRAME);
+			*pte = old->pt_dir[i][j];
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * Swap space on a raw disk.
+ *
+ * The whole of SWAP_DEVICE is used as an array of page-sized slots.
+ * swap_lock only covers the slot bitmap; the disk I/O itself is done
+ * without it, since writing a page out can need memory (for kmalloc)
+ * and getting that memory can mean evicting another page.
+ *
+ * The VM system serializes paging (see vm_lock in dumbvm.c), so a
+ * slot is never read and written at the same time.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <synch.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <swap.h>
+#include <uw-vmstats.h>
+
+#define SWAP_DEVICE "lhd1raw:"
+
+static struct vnode *swap_vnode;	/* NULL if there is no swap */
+static struct bitmap *swap_map;		/* one bit per slot, set if in use */
+static struct lock *swap_lock;
+static unsigned swap_nslots;
+
+void
+swap_bootstrap(void)
+{
+	char path[] = SWAP_DEVICE;
+	struct stat st;
+	int result;
+
+	swap_vnode = NULL;
+
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: %s: %s; paging disabled\n", SWAP_DEVICE,
+			strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: %s: stat: %s\n", SWAP_DEVICE, strerror(result));
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	if (swap_nslots == 0) {
+		kprintf("swap: %s is too small; paging disabled\n", SWAP_DEVICE);
+		vfs_close(swap_vnode);
+		swap_vnode = NULL;
+		return;
+	}
+
+	swap_map = bitmap_create(swap_nslots);
+	swap_lock = lock_create("swap");
+	if (swap_map == NULL || swap_lock == NULL) {
+		panic("swap: out of memory\n");
+	}
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
+
+bool
+swap_available(void)
+{
+	return swap_vnode != NULL;
+}
+
+static
+int
+swap_alloc(unsigned *slot)
+{
+	int result;
+
+	lock_acquire(swap_lock);
+	result = bitmap_alloc(swap_map, slot);
+	lock_release(swap_lock);
+
+	if (result) {
+		kprintf("swap: out of swap space\n");
+		return ENOSPC;
+	}
+	return 0;
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+
+	lock_acquire(swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	lock_release(swap_lock);
+}
+
+/* Transfer one page between kernel address KBUF and SLOT. */
+static
+int
+swap_io(void *kbuf, unsigned slot, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &ku, kbuf, PAGE_SIZE, (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+		vmstats_inc(VMSTAT_SWAP_FILE_READ);
+	} else {
+		result = VOP_WRITE(swap_vnode, &ku);
+		vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		/* The device is a whole number of pages, so this shouldn't happen */
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_out(paddr_t paddr, unsigned *slot)
+{
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+
+	result = swap_alloc(slot);
+	if (result) {
+		return result;
+	}
+
+	result = swap_io((void *)PADDR_TO_KVADDR(paddr), *slot, UIO_WRITE);
+	if (result) {
+		swap_free(*slot);
+		return result;
+	}
+	return 0;
+}
+
+int
+swap_in(unsigned slot, paddr_t paddr)
+{
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+
+	result = swap_io((void *)PADDR_TO_KVADDR(paddr), slot, UIO_READ);
+	if (result) {
+		return result;
+	}
+
+	/* The page table now points at the frame, not the slot */
+	swap_free(slot);
+	return 0;
+}
+
+int
+swap_dup(unsigned slot, unsigned *newslot)
+{
+	void *buf;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+
+	buf = kmalloc(PAGE_SIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	result = swap_io(buf, slot, UIO_READ);
+	if (result) {
+		kfree(buf);
+		return result;
+	}
+
+	result = swap_alloc(newslot);
+	if (result) {
+		kfree(buf);
+		return result;
+	}
+
+	result = swap_io(buf, *newslot, UIO_WRITE);
+	if (result) {
+		swap_free(*newslot);
+	}
+	kfree(buf);
+	return result;
+}
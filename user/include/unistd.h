@@ -38,6 +38,8 @@
  * about the kern/ headers.
  */
 #include <kern/fcntl.h>
+#include <kern/ioring.h>
+#include <kern/iovec.h>
 #include <kern/ioctl.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
@@ -152,8 +154,17 @@ int symlink(const char *target, const char *linkname);
 int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
+int pread(int filehandle, void *buf, size_t size, off_t pos);
+int pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+int readv(int filehandle, const struct iovec *iov, int iovcnt);
+int writev(int filehandle, const struct iovec *iov, int iovcnt);
+pid_t vfork(void);
+pid_t spawn(const char *prog, char *const *args);	/* fork+execv in one */
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
+int __clock_gettime(int clockid, struct timespec *ts);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 int __getcwd(char *buf, size_t buflen);
+int ioring_enter(struct ioring *ring);	/* see kern/ioring.h */
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -162,6 +173,7 @@ int __getcwd(char *buf, size_t buflen);
  */
 
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
-time_t time(time_t *seconds);			/* calls __time */
+time_t time(time_t *seconds);			/* reads the time page */
+int clock_gettime(int clockid, struct timespec *ts); /* may call __clock_gettime */
 
 #endif /* _UNISTD_H_ */
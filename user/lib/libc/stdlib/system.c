@@ -27,6 +27,7 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/wait.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -74,18 +75,13 @@ system(const char *cmd)
 
 	argv[nargs] = NULL;
 
-	pid = fork();
-	switch (pid) {
-	    case -1:
-		return -1;
-	    case 0:
-		/* child */
-		execv(argv[0], argv);
-		/* exec only returns if it fails */
-		_exit(255);
-	    default:
-		/* parent */
-		waitpid(pid, &status, 0);
-		return status;
+	/* fork and execv in one, without copying our address space */
+	pid = spawn(argv[0], argv);
+	if (pid < 0) {
+		/* the same status as a child whose execv failed */
+		return _MKWAIT_EXIT(255);
 	}
+
+	waitpid(pid, &status, 0);
+	return status;
 }
@@ -45,26 +45,91 @@
 extern char **__argv;
 
 /*
- * Routine to print error message text to stderr.
+ * The pieces of one message, gathered up so the whole thing goes to
+ * stderr with a single writev. Strings that stay put are pointed to;
+ * what __vprintf hands us is copied into buf.
+ */
+#define ERR_NIOV 8
+#define ERR_BUFSIZE 256
+
+struct errout {
+	struct iovec iov[ERR_NIOV];
+	int niov;
+	char buf[ERR_BUFSIZE];
+	size_t len;
+};
+
+/*
+ * Send what has been gathered so far.
  */
 static
 void
-__senderr(void *junk, const char *data, size_t len)
+__errflush(struct errout *eo)
 {
-	(void)junk;  /* not needed or used */
+	if (eo->niov > 0) {
+		writev(STDERR_FILENO, eo->iov, eo->niov);
+	}
+	eo->niov = 0;
+	eo->len = 0;
+}
 
-	write(STDERR_FILENO, data, len);
+/*
+ * Add LEN bytes at DATA, which must stay put until the next flush.
+ */
+static
+void
+__errpiece(struct errout *eo, const char *data, size_t len)
+{
+	if (eo->niov == ERR_NIOV) {
+		__errflush(eo);
+	}
+	eo->iov[eo->niov].iov_base = (void *)data;
+	eo->iov[eo->niov].iov_len = len;
+	eo->niov++;
 }
 
 /*
- * Shortcut to call __senderr on a null-terminated string.
- * (__senderr is set up to be called by __vprintf.)
+ * Routine to add error message text; it is set up to be called by
+ * __vprintf, so the text is copied.
  */
 static
 void
-__senderrstr(const char *str)
+__senderr(void *eov, const char *data, size_t len)
 {
-	__senderr(NULL, str, strlen(str));
+	struct errout *eo = eov;
+	struct iovec *last;
+
+	/* flush first if need be, so nothing moves once it's copied */
+	if (len > ERR_BUFSIZE - eo->len || eo->niov == ERR_NIOV) {
+		__errflush(eo);
+	}
+	if (len > ERR_BUFSIZE) {
+		write(STDERR_FILENO, data, len);
+		return;
+	}
+
+	memcpy(eo->buf + eo->len, data, len);
+
+	/* run on from the last piece if it was copied in just before */
+	last = eo->niov > 0 ? &eo->iov[eo->niov - 1] : NULL;
+	if (last != NULL &&
+	    (char *)last->iov_base + last->iov_len == eo->buf + eo->len) {
+		last->iov_len += len;
+	}
+	else {
+		__errpiece(eo, eo->buf + eo->len, len);
+	}
+	eo->len += len;
+}
+
+/*
+ * Shortcut to add a null-terminated string that stays put.
+ */
+static
+void
+__senderrstr(struct errout *eo, const char *str)
+{
+	__errpiece(eo, str, strlen(str));
 }
 
 /*
@@ -74,9 +139,13 @@ static
 void
 __printerr(int use_errno, const char *fmt, va_list ap)
 {
+	struct errout eo;
 	const char *errmsg;
 	const char *prog;
 
+	eo.niov = 0;
+	eo.len = 0;
+
 	/*
 	 * Get the error message for the current errno.
 	 * Do this early, before doing anything that might change the
@@ -99,20 +168,23 @@ __printerr(int use_errno, const char *fmt, va_list ap)
 	}
 
 	/* print the program name */
-	__senderrstr(prog);
-	__senderrstr(": ");
+	__senderrstr(&eo, prog);
+	__senderrstr(&eo, ": ");
 
 	/* process the printf format and args */
-	__vprintf(__senderr, NULL, fmt, ap);
+	__vprintf(__senderr, &eo, fmt, ap);
 
 	/* if we're using errno, print the error string from above. */
 	if (use_errno) {
-		__senderrstr(": ");
-		__senderrstr(errmsg);
+		__senderrstr(&eo, ": ");
+		__senderrstr(&eo, errmsg);
 	}
 
 	/* and always add a newline. */
-	__senderrstr("\n");
+	__senderrstr(&eo, "\n");
+
+	/* all in one go */
+	__errflush(&eo);
 }
 
 /*
@@ -33,9 +33,86 @@
  *
  * Intended for the basic system calls assignment. This may help
  * debugging the argument handling of execv().
+ *
+ * "argtest -many N" instead execs itself with N extra arguments
+ * (thousands is fine; it all has to fit in ARG_MAX) and checks that
+ * every one of them comes through intact.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#define MAXMANY 4000
+#define ARGLEN 8	/* room for "a" plus the number */
+
+static char *manyargv[MAXMANY + 4];
+static char manystrs[MAXMANY][ARGLEN];
+
+static
+void
+manyarg(int i, char *buf)
+{
+	snprintf(buf, ARGLEN, "a%d", i);
+}
+
+/* argtest -many N: exec ourselves with N more arguments */
+static
+void
+many(const char *prog, int n)
+{
+	static char nbuf[16];
+	int i;
+
+	if (n < 0 || n > MAXMANY) {
+		errx(1, "-many: between 0 and %d, please", MAXMANY);
+	}
+
+	snprintf(nbuf, sizeof(nbuf), "%d", n);
+	manyargv[0] = (char *)prog;
+	manyargv[1] = (char *)"-check";
+	manyargv[2] = nbuf;
+	for (i=0; i<n; i++) {
+		manyarg(i, manystrs[i]);
+		manyargv[i+3] = manystrs[i];
+	}
+	manyargv[n+3] = NULL;
+
+	printf("argtest: execing with %d arguments\n", n+3);
+	execv(prog, manyargv);
+	err(1, "%s", prog);
+}
+
+/* argtest -check N ...: what "argtest -many N" execs */
+static
+int
+check(int argc, char *argv[])
+{
+	char buf[ARGLEN];
+	int i, n;
+
+	n = atoi(argv[2]);
+	if (argc != n+3) {
+		printf("argtest: FAILED: argc is %d, expected %d\n", argc, n+3);
+		return 1;
+	}
+	if (argv[argc] != NULL) {
+		printf("argtest: FAILED: argv[%d] is not NULL\n", argc);
+		return 1;
+	}
+	for (i=0; i<n; i++) {
+		manyarg(i, buf);
+		if (strcmp(argv[i+3], buf) != 0) {
+			printf("argtest: FAILED: argv[%d] is %s, expected %s\n",
+			       i+3, argv[i+3], buf);
+			return 1;
+		}
+	}
+	printf("argtest: passed, %d arguments\n", argc);
+	return 0;
+}
 
 int
 main(int argc, char *argv[])
@@ -43,6 +120,14 @@ main(int argc, char *argv[])
 	const char *tmp;
 	int i;
 
+	if (argc == 3 && !strcmp(argv[1], "-many")) {
+		/* Exec ourselves by the same name we were run under */
+		many(argv[0], atoi(argv[2]));
+	}
+	if (argc >= 3 && !strcmp(argv[1], "-check")) {
+		return check(argc, argv);
+	}
+
 	printf("argc: %d\n", argc);
 
 	for (i=0; i<=argc; i++) {
@@ -0,0 +1,446 @@
+/*
+ * pipetest - test pipes, both the ring buffer and the page lending.
+ *
+ * A write of whole page-aligned pages lends the pages to the pipe
+ * instead of copying them, and a page-aligned read of a whole lent
+ * page maps it rather than copying it out; everything else goes
+ * through the pipe's ring. This passes data between processes every
+ * way that mixes those up, and checks that
+ *
+ *    - the reader sees what was written, in order, however it reads;
+ *    - the writer can change its buffer as soon as write returns
+ *      without the reader seeing it;
+ *    - the reader can write to a page it was given without the writer
+ *      seeing it;
+ *    - closing either end with lent pages still queued works.
+ *
+ * Should print "pipetest: passed" at the end.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define PAGESIZE	4096
+#define NPAGES		8	/* fewer than the pipe will hold lent at once */
+#define RINGBYTES	(3 * PAGESIZE + 1234)
+#define CLOSEROUNDS	32
+
+/* Room for NPAGES whole pages, plus whatever aligning them wastes */
+static char wspace[(NPAGES + 1) * PAGESIZE];
+static char rspace[(NPAGES + 1) * PAGESIZE];
+static char *wbuf, *rbuf;
+
+/* What's at position POS of the stream for test SEED */
+static
+unsigned char
+pat(unsigned seed, unsigned pos)
+{
+	return (pos * 7 + (pos / PAGESIZE) * 13 + seed) & 0xff;
+}
+
+static
+void
+fill(char *buf, unsigned seed, unsigned pos, unsigned len)
+{
+	unsigned i;
+
+	for (i = 0; i < len; i++) {
+		buf[i] = pat(seed, pos + i);
+	}
+}
+
+/* Exit if BUF isn't stream positions POS through POS+LEN of SEED */
+static
+void
+check(const char *what, const char *buf, unsigned seed, unsigned pos,
+      unsigned len)
+{
+	unsigned i;
+
+	for (i = 0; i < len; i++) {
+		if ((unsigned char)buf[i] != pat(seed, pos + i)) {
+			errx(1, "%s: byte %u is 0x%x, should be 0x%x", what,
+			     pos + i, (unsigned char)buf[i], pat(seed, pos + i));
+		}
+	}
+}
+
+static
+char *
+pagealign(char *p)
+{
+	return (char *)(((uintptr_t)p + PAGESIZE - 1) & ~(uintptr_t)(PAGESIZE - 1));
+}
+
+static
+void
+writeall(int fd, const char *buf, unsigned len)
+{
+	int r;
+
+	r = write(fd, buf, len);
+	if (r < 0) {
+		err(1, "write");
+	}
+	if ((unsigned)r != len) {
+		errx(1, "write: wrote %d of %u bytes", r, len);
+	}
+}
+
+/* Read until LEN bytes have come or the pipe is empty and closed. */
+static
+unsigned
+readall(int fd, char *buf, unsigned len)
+{
+	unsigned done = 0;
+	int r;
+
+	while (done < len) {
+		r = read(fd, buf + done, len - done);
+		if (r < 0) {
+			err(1, "read");
+		}
+		if (r == 0) {
+			break;
+		}
+		done += r;
+	}
+	return done;
+}
+
+static
+void
+readexact(const char *what, int fd, char *buf, unsigned len)
+{
+	unsigned n;
+
+	n = readall(fd, buf, len);
+	if (n != len) {
+		errx(1, "%s: read %u of %u bytes", what, n, len);
+	}
+}
+
+static
+void
+expecteof(const char *what, int fd)
+{
+	char c;
+	int r;
+
+	r = read(fd, &c, 1);
+	if (r < 0) {
+		err(1, "%s: read at end", what);
+	}
+	if (r != 0) {
+		errx(1, "%s: more data than was written", what);
+	}
+}
+
+static
+void
+dopipe(int fds[2])
+{
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+}
+
+static
+pid_t
+dofork(void)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	return pid;
+}
+
+static
+void
+waitfor(const char *what, pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "%s: waitpid", what);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "%s: child failed", what);
+	}
+}
+
+/*
+ * The child writes NPAGES lent pages, scribbles over its buffer and
+ * exits; only then does the parent read them, one page mapped whole,
+ * one copied to an unaligned buffer, one in two pieces, and the rest
+ * mapped in one go. Then it writes over what it read.
+ */
+static
+void
+test_lend(void)
+{
+	const unsigned seed = 1;
+	char *p;
+	int fds[2];
+	pid_t pid;
+
+	dopipe(fds);
+	pid = dofork();
+	if (pid == 0) {
+		close(fds[0]);
+		fill(wbuf, seed, 0, NPAGES * PAGESIZE);
+		writeall(fds[1], wbuf, NPAGES * PAGESIZE);
+		/* The pages belong to the pipe now; this mustn't show */
+		memset(wbuf, 0xa5, NPAGES * PAGESIZE);
+		_exit(0);
+	}
+	close(fds[1]);
+	waitfor("lend", pid);
+
+	/* Page 0: aligned, so it gets mapped */
+	readexact("lend: aligned", fds[0], rbuf, PAGESIZE);
+	check("lend: aligned", rbuf, seed, 0, PAGESIZE);
+
+	/* Page 1: one byte off, so it gets copied */
+	p = rbuf + PAGESIZE + 1;
+	readexact("lend: unaligned", fds[0], p, PAGESIZE);
+	check("lend: unaligned", p, seed, PAGESIZE, PAGESIZE);
+
+	/* Page 2: a bit of it, then the rest of it */
+	p = rbuf + 2 * PAGESIZE;
+	readexact("lend: partial", fds[0], p, 100);
+	readexact("lend: partial", fds[0], p + 100, PAGESIZE - 100);
+	check("lend: partial", p, seed, 2 * PAGESIZE, PAGESIZE);
+
+	/* The rest, all at once */
+	p = rbuf + 3 * PAGESIZE;
+	readexact("lend: bulk", fds[0], p, (NPAGES - 3) * PAGESIZE);
+	check("lend: bulk", p, seed, 3 * PAGESIZE, (NPAGES - 3) * PAGESIZE);
+	expecteof("lend", fds[0]);
+	close(fds[0]);
+
+	/* The mapped pages are ours to write to */
+	fill(rbuf, seed + 1, 0, PAGESIZE);
+	fill(rbuf + 3 * PAGESIZE, seed + 1, 3 * PAGESIZE,
+	     (NPAGES - 3) * PAGESIZE);
+	check("lend: rewrite", rbuf, seed + 1, 0, PAGESIZE);
+	check("lend: rewrite", rbuf + 3 * PAGESIZE, seed + 1, 3 * PAGESIZE,
+	      (NPAGES - 3) * PAGESIZE);
+
+	printf("pipetest: lent pages ok\n");
+}
+
+/*
+ * The child lends some pages and waits while the parent maps them and
+ * writes over them; then the child checks its own copy is untouched.
+ */
+static
+void
+test_readerwrites(void)
+{
+	const unsigned seed = 2;
+	const unsigned len = 4 * PAGESIZE;
+	int data[2], back[2];
+	char c;
+	pid_t pid;
+
+	dopipe(data);
+	dopipe(back);
+	pid = dofork();
+	if (pid == 0) {
+		close(data[0]);
+		close(back[1]);
+		fill(wbuf, seed, 0, len);
+		writeall(data[1], wbuf, len);
+		close(data[1]);
+		if (readall(back[0], &c, 1) != 1) {
+			errx(1, "readerwrites: no word from the reader");
+		}
+		check("readerwrites: writer's copy", wbuf, seed, 0, len);
+		_exit(0);
+	}
+	close(data[1]);
+	close(back[0]);
+
+	readexact("readerwrites", data[0], rbuf, len);
+	check("readerwrites", rbuf, seed, 0, len);
+	expecteof("readerwrites", data[0]);
+	close(data[0]);
+
+	memset(rbuf, 0x5a, len);
+	c = 'x';
+	writeall(back[1], &c, 1);
+	close(back[1]);
+	waitfor("readerwrites", pid);
+
+	printf("pipetest: reader's writes ok\n");
+}
+
+/*
+ * Nothing aligned, so everything goes through the ring, with both
+ * sides at it at once and the ring wrapping several times.
+ */
+static
+void
+test_ring(void)
+{
+	const unsigned seed = 3;
+	unsigned pos, n;
+	int fds[2];
+	pid_t pid;
+	char *p;
+
+	dopipe(fds);
+	pid = dofork();
+	if (pid == 0) {
+		close(fds[0]);
+		p = wbuf + 3;
+		fill(p, seed, 0, RINGBYTES);
+		for (pos = 0; pos < RINGBYTES; pos += n) {
+			n = RINGBYTES - pos < 1000 ? RINGBYTES - pos : 1000;
+			writeall(fds[1], p + pos, n);
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+
+	p = rbuf + 5;
+	for (pos = 0; pos < RINGBYTES; pos += n) {
+		n = RINGBYTES - pos < 777 ? RINGBYTES - pos : 777;
+		readexact("ring", fds[0], p + pos, n);
+	}
+	check("ring", p, seed, 0, RINGBYTES);
+	expecteof("ring", fds[0]);
+	close(fds[0]);
+	waitfor("ring", pid);
+
+	printf("pipetest: ring ok\n");
+}
+
+/*
+ * Bytes through the ring and lent pages, one after the other; read
+ * back once in page-aligned pieces and once in odd ones.
+ */
+static
+void
+test_mixed(void)
+{
+	const unsigned seed = 4;
+	/* ring, lent, ring, lent */
+	static const unsigned lens[4] = {
+		100, 2 * PAGESIZE, 50, PAGESIZE,
+	};
+	const unsigned total = 100 + 3 * PAGESIZE + 50;
+	unsigned pos, n, i;
+	int fds[2], pass;
+	pid_t pid;
+
+	for (pass = 0; pass < 2; pass++) {
+		dopipe(fds);
+		pid = dofork();
+		if (pid == 0) {
+			close(fds[0]);
+			pos = 0;
+			for (i = 0; i < 4; i++) {
+				/* The pages are aligned; the odd bytes needn't be */
+				fill(wbuf, seed, pos, lens[i]);
+				writeall(fds[1], wbuf, lens[i]);
+				pos += lens[i];
+			}
+			_exit(0);
+		}
+		close(fds[1]);
+		waitfor("mixed", pid);
+
+		for (pos = 0; pos < total; pos += n) {
+			if (pass == 0) {
+				n = PAGESIZE;
+			}
+			else {
+				n = 333;
+			}
+			if (n > total - pos) {
+				n = total - pos;
+			}
+			readexact("mixed", fds[0], rbuf, n);
+			check("mixed", rbuf, seed, pos, n);
+		}
+		expecteof("mixed", fds[0]);
+		close(fds[0]);
+	}
+
+	printf("pipetest: mixed ring and lent pages ok\n");
+}
+
+/*
+ * Close the read end with lent pages still queued, having read none
+ * or some of them, often enough that leaking them would run out of
+ * memory. Then write to a pipe nobody can read.
+ */
+static
+void
+test_close(void)
+{
+	const unsigned seed = 5;
+	unsigned round;
+	int fds[2];
+	pid_t pid;
+
+	for (round = 0; round < CLOSEROUNDS; round++) {
+		dopipe(fds);
+		pid = dofork();
+		if (pid == 0) {
+			close(fds[0]);
+			fill(wbuf, seed, 0, NPAGES * PAGESIZE);
+			writeall(fds[1], wbuf, NPAGES * PAGESIZE);
+			_exit(0);
+		}
+		close(fds[1]);
+		waitfor("close", pid);
+		if (round % 2 == 1) {
+			readexact("close", fds[0], rbuf, PAGESIZE);
+			check("close", rbuf, seed, 0, PAGESIZE);
+		}
+		close(fds[0]);
+	}
+
+	dopipe(fds);
+	close(fds[0]);
+	fill(wbuf, seed, 0, PAGESIZE);
+	errno = 0;
+	if (write(fds[1], wbuf, PAGESIZE) >= 0 || errno != EPIPE) {
+		errx(1, "close: page write with no reader didn't fail with EPIPE");
+	}
+	errno = 0;
+	if (write(fds[1], wbuf + 1, 10) >= 0 || errno != EPIPE) {
+		errx(1, "close: write with no reader didn't fail with EPIPE");
+	}
+	close(fds[1]);
+
+	printf("pipetest: closing with pages queued ok\n");
+}
+
+int
+main(void)
+{
+	wbuf = pagealign(wspace);
+	rbuf = pagealign(rspace);
+
+	test_lend();
+	test_readerwrites();
+	test_ring();
+	test_mixed();
+	test_close();
+
+	printf("pipetest: passed\n");
+	return 0;
+}
@@ -53,12 +53,13 @@ tail(int file, off_t where, const char *filename)
 {
 	int len;
 
-	if (lseek(file, where, SEEK_SET)<0) {
-		err(1, "%s", filename);
-	}
-	
-	while ((len = read(file, buffer, sizeof(buffer))) > 0) {
+	/* pread saves the lseek, and leaves the file's offset alone */
+	while ((len = pread(file, buffer, sizeof(buffer), where)) > 0) {
 		write(STDOUT_FILENO, buffer, len);
+		where += len;
+	}
+	if (len<0) {
+		err(1, "%s", filename);
 	}
 }
 